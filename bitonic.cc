@@ -20,16 +20,23 @@
 #include <algorithm>
 #include <bit>
 #include <climits>
+#include <cstdint>
 #include <cstdlib>
+#include <functional>
 #include <iostream>
 #include <iterator>
 #include <limits>
 #include <memory>
+#include <optional>
 #include <random>
+#include <span>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "philox.hpp"
 #include "popl.hpp"
+#include "validation.hpp"
 
 #ifdef PAR_CPU_SORT
 
@@ -71,25 +78,74 @@ int validate_results(const auto &origin, const auto &res, const auto &check, boo
   return EXIT_FAILURE;
 }
 
+// The input isn't kept around, on failure it is reproduced from the generator to be printed
+int validate_sorted(const auto &res, clutils::sort_check_result result, std::uint64_t origin_hash,
+                    const clutils::counter_based_generator<TYPE__> &gen, bool print_on_failure) {
+  if (result.sorted && result.hash == origin_hash) {
+    std::cout << "Bitonic sort works fine\n";
+    return EXIT_SUCCESS;
+  }
+
+  std::cout << "Bitonic sort is broken: ";
+  if (!result.sorted) std::cout << "result is not sorted\n";
+  else std::cout << "result is not a permutation of the input\n";
+
+  if (print_on_failure) {
+    vector_type origin;
+    origin.resize(res.size());
+    gen.fill(origin);
+
+    vprint("Original", origin);
+    vprint("Result", res);
+  }
+
+  return EXIT_FAILURE;
+}
+
 template <typename T> struct type_name {};
 template <> struct type_name<TYPE__> {
   static constexpr const char *name_str = STRINGIFY(TYPE__);
 };
 
+// Sorts by feeding the sequence into a device-resident sorted array batch by batch
+template <typename T> class incremental_sort : public bitonic::i_bitonic_sort<T> {
+  bitonic::sorted_device_array<T, type_name<T>> m_array;
+  std::size_t m_batch_size;
+
+public:
+  incremental_sort(unsigned segment_size, unsigned batch_size, bitonic::gpu_bitonic<T> base)
+      : m_array{segment_size, base}, m_batch_size{batch_size} {
+    if (batch_size == 0) throw std::invalid_argument{"Batch size can't be zero"};
+  }
+
+  void operator()(std::span<T> container, clutils::profiling_info *time) override {
+    clutils::profiling_info batch_info, total_info = {};
+    m_array.clear();
+
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    for (std::size_t start = 0; start < container.size(); start += m_batch_size) {
+      const auto count = std::min(m_batch_size, container.size() - start);
+      m_array.insert(container.subspan(start, count), &batch_info);
+      total_info.pure += batch_info.pure;
+    }
+
+    m_array.copy_to(container);
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+
+    total_info.wall = std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start);
+    if (time) *time = total_info;
+  }
+};
+
 template <typename T> void optimal_bitonic_sort(std::vector<T> &vec) {
-  const unsigned n = vec.size();
+  const std::size_t n = vec.size();
 
   if (n == 0 || n == 1) {
     return; /* Nothing to do */
   }
 
   // Closest power of two size
-  unsigned closest_size;
-  if (std::popcount(n) == 1) {
-    closest_size = n;
-  } else {
-    closest_size = 1 << (sizeof(decltype(n)) * CHAR_BIT - std::countl_zero(n));
-  }
+  const std::size_t closest_size = std::bit_ceil(n);
 
   bitonic::gpu_bitonic<T> sorter_base{false};
 
@@ -137,13 +193,118 @@ template <typename T> void optimal_bitonic_sort(std::vector<T> &vec) {
   vec.erase(std::remove_if(vec.begin(), vec.end(), pred), vec.end());
 }
 
+int run_topk(unsigned num, unsigned k, unsigned lsz, bitonic::topk_order order, bitonic::gpu_bitonic<TYPE__> base,
+             const clutils::counter_based_generator<TYPE__> &gen, bool skip_std_sort, bool print_on_failure) {
+  const std::size_t size = (std::size_t{1} << num);
+  const auto print_sep = []() { std::cout << " -------- \n"; };
+
+  std::cout << "Selecting k = " << k << " elements from vector of size = " << size << "\n";
+  print_sep();
+
+  vector_type origin;
+  origin.resize(size);
+  gen.fill(origin);
+
+  bitonic::topk_bitonic<TYPE__, type_name<TYPE__>> selector{lsz, order, base};
+
+  clutils::profiling_info prof_info;
+  auto res = selector.select(origin, k, &prof_info);
+
+  std::chrono::milliseconds wall;
+  auto check = origin;
+
+  if (!skip_std_sort) {
+    auto wall_start = std::chrono::high_resolution_clock::now();
+    if (order == bitonic::topk_order::smallest) {
+      std::partial_sort(check.begin(), check.begin() + k, check.end());
+    } else {
+      std::partial_sort(check.begin(), check.begin() + k, check.end(), std::greater<TYPE__>{});
+    }
+    auto wall_end = std::chrono::high_resolution_clock::now();
+    wall = std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start);
+    check.resize(k);
+  }
+
+  if (!skip_std_sort) std::cout << "std::partial_sort wall time: " << wall.count() << " ms\n";
+
+  std::cout << "bitonic top-k wall time: " << prof_info.wall.count() << " ms\n";
+  std::cout << "bitonic top-k pure time: " << prof_info.pure.count() << " ms\n";
+
+  print_sep();
+
+  if (skip_std_sort) return EXIT_SUCCESS;
+  return validate_results(origin, res, check, print_on_failure);
+}
+
+std::optional<clutils::sort_check_result> check_device_result(bitonic::gpu_bitonic<TYPE__> base, cl::Buffer buf,
+                                                            std::size_t size, const std::string &validate_mode) {
+  if (validate_mode == "none") return std::nullopt;
+  if (validate_mode == "device") return bitonic::sort_validator<TYPE__, type_name<TYPE__>>{base}.check(buf, size);
+
+  vector_type res;
+  res.resize(size);
+  base.download(buf, res);
+  return clutils::check_sorted<TYPE__>(res);
+}
+
+// Input is generated in place on the device, the host reproduces the same stream only to hash it and to time std::sort
+int run_device_generated(unsigned num, unsigned lsz, unsigned regs, bitonic::gpu_bitonic<TYPE__> base,
+                         const clutils::counter_based_generator<TYPE__> &gen, const std::string &validate_mode,
+                         bool skip_std_sort, bool print_on_failure) {
+  const std::size_t size = (std::size_t{1} << num);
+  const auto print_sep = []() { std::cout << " -------- \n"; };
+
+  std::cout << "Sorting vector of size = " << size << " generated on the device\n";
+  print_sep();
+
+  bitonic::local_bitonic<TYPE__, type_name<TYPE__>> sorter{lsz, base, regs};
+  bitonic::device_random_generator<TYPE__, type_name<TYPE__>> device_gen{base};
+
+  auto buf = device_gen.generate(size, gen);
+
+  vector_type origin;
+  origin.resize(size);
+  gen.fill(origin);
+  const auto origin_hash = clutils::multiset_hash<TYPE__>(origin);
+
+  std::chrono::milliseconds wall;
+
+  if (!skip_std_sort) {
+    auto wall_start = std::chrono::high_resolution_clock::now();
+    CPU_SORT(origin.begin(), origin.end());
+    auto wall_end = std::chrono::high_resolution_clock::now();
+    wall = std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start);
+  }
+
+  clutils::profiling_info prof_info;
+  sorter.sort(buf, size, &prof_info);
+
+  if (!skip_std_sort) std::cout << CPU_SORT_NAME << " wall time: " << wall.count() << " ms\n";
+
+  std::cout << "bitonic wall time: " << prof_info.wall.count() << " ms\n";
+  std::cout << "bitonic pure time: " << prof_info.pure.count() << " ms\n";
+
+  print_sep();
+
+  const auto result = check_device_result(base, buf, size, validate_mode);
+  if (!result) return EXIT_SUCCESS;
+
+  vector_type res;
+  if (print_on_failure) {
+    res.resize(size);
+    base.download(buf, res);
+  }
+
+  return validate_sorted(res, *result, origin_hash, gen, print_on_failure);
+}
+
 int main(int argc, char **argv) try {
   const auto maximum = std::numeric_limits<TYPE__>::max(), minimum = std::numeric_limits<TYPE__>::min();
 
   popl::OptionParser op("Avaliable options");
   auto help_option = op.add<popl::Switch>("h", "help", "Print this help message");
   auto print_option = op.add<popl::Switch>("p", "print", "Print on failure");
-  auto skip_option = op.add<popl::Switch>("s", "skip", "Skip comparing with std::sort");
+  auto skip_option = op.add<popl::Switch>("s", "skip", "Skip timing std::sort");
   auto random_option = op.add<popl::Switch>("r", "random", "Generate random vectors");
 
   auto lower_option = op.add<popl::Implicit<TYPE__>>("", "lower", "Lower bound", minimum);
@@ -151,8 +312,21 @@ int main(int argc, char **argv) try {
 
   auto num_option = op.add<popl::Implicit<unsigned>>("", "num", "Length of the array to sort = 2^n", 24);
   auto kernel_option =
-      op.add<popl::Implicit<std::string>>("", "kernel", "Which kernel to use: naive, cpu, local", "naive");
+      op.add<popl::Implicit<std::string>>("", "kernel", "Which kernel to use: naive, cpu, local, incremental", "naive");
   auto lsz_option = op.add<popl::Implicit<unsigned>>("", "lsz", "Local memory size", 256);
+  auto regs_option = op.add<popl::Implicit<unsigned>>(
+      "", "regs", "Elements each work-item of the local kernel sorts in registers: 2, 4, 8 or 16", 2);
+  auto batch_option =
+      op.add<popl::Implicit<unsigned>>("", "batch", "Size of batches to insert with the incremental kernel", 65536);
+  auto topk_option = op.add<popl::Implicit<unsigned>>("", "topk", "Select only k smallest elements", 16);
+  auto largest_option = op.add<popl::Switch>("", "largest", "Select k largest elements instead of the smallest");
+  auto validate_option =
+      op.add<popl::Implicit<std::string>>("", "validate", "Where to validate the result: host, device, none", "host");
+  auto seed_option = op.add<popl::Value<std::uint64_t>>("", "seed", "Seed of the random generator, random if not set");
+  auto device_gen_option =
+      op.add<popl::Switch>("", "device-gen", "Generate random input directly on the device, local kernel only");
+  auto wide_index_option =
+      op.add<popl::Switch>("", "wide-index", "Use kernels with 64-bit indices for sequences of any length");
 
   op.parse(argc, argv);
 
@@ -165,7 +339,7 @@ int main(int argc, char **argv) try {
     std::cin.exceptions(std::cin.exceptions() | std::ios::badbit | std::ios::failbit);
     vector_type input;
 
-    unsigned n;
+    std::size_t n;
     std::cin >> n;
 
     if (n == 0) {
@@ -191,45 +365,106 @@ int main(int argc, char **argv) try {
   const auto kernel_name = kernel_option->value();
   const auto lsz = lsz_option->value();
   const bool verbose = random_option->is_set();
+  const auto validate_mode = validate_option->value();
+
+  if (lower >= upper) {
+    std::cout << "Error: lower bound can't be greater than the upper bound\n";
+    return EXIT_FAILURE;
+  }
+
+  if (validate_mode != "host" && validate_mode != "device" && validate_mode != "none") {
+    std::cout << "Unknown validation mode: " << validate_mode << "\n ";
+    return EXIT_FAILURE;
+  }
+
+  const auto gen = (seed_option->is_set() ? clutils::counter_based_generator<TYPE__>{lower, upper, seed_option->value()}
+                                           : clutils::counter_based_generator<TYPE__>{lower, upper});
+  std::cout << "Random generator seed = " << gen.seed() << "\n";
+
+  // GPU sorters and the device validator share a single context, so the platform is selected and reported once
+  std::optional<bitonic::gpu_bitonic<TYPE__>> gpu_base;
+  const auto base = [&]() {
+    if (!gpu_base) {
+      gpu_base.emplace(verbose);
+      if (wide_index_option->is_set()) gpu_base->force_wide_index();
+    }
+    return *gpu_base;
+  };
+
+  if (topk_option->is_set()) {
+    if (validate_option->is_set()) {
+      std::cout << "Warning: top-k is validated against std::partial_sort, ignoring --validate option\n";
+    }
+
+    if (kernel_option->is_set() && kernel_name != "local") {
+      std::cout << "Warning: top-k runs are always sorted by the local kernel, ignoring --kernel option\n";
+    }
+
+    const auto order = (largest_option->is_set() ? bitonic::topk_order::largest : bitonic::topk_order::smallest);
+    return run_topk(num, topk_option->value(), lsz, order, base(), gen, skip_std_sort, print_on_failure);
+  }
+
+  if (device_gen_option->is_set()) {
+    if (kernel_name == "local") {
+      return run_device_generated(num, lsz, regs_option->value(), base(), gen, validate_mode, skip_std_sort,
+                                  print_on_failure);
+    }
+
+    std::cout << "Warning: only the local kernel sorts device buffers in place, ignoring --device-gen option\n";
+  }
 
   std::unique_ptr<bitonic::i_bitonic_sort<TYPE__>> sorter;
 
   if (kernel_name == "naive") {
-    sorter = std::make_unique<bitonic::naive_bitonic<TYPE__, type_name<TYPE__>>>(verbose);
+    sorter = std::make_unique<bitonic::naive_bitonic<TYPE__, type_name<TYPE__>>>(base());
   } else if (kernel_name == "cpu") {
     sorter = std::make_unique<bitonic::cpu_bitonic_sort<TYPE__>>();
   } else if (kernel_name == "local") {
-    sorter = std::make_unique<bitonic::local_bitonic<TYPE__, type_name<TYPE__>>>(lsz, verbose);
+    sorter = std::make_unique<bitonic::local_bitonic<TYPE__, type_name<TYPE__>>>(lsz, base(), regs_option->value());
+  } else if (kernel_name == "incremental") {
+    sorter = std::make_unique<incremental_sort<TYPE__>>(lsz, batch_option->value(), base());
   } else {
     std::cout << "Unknown type of kernel: " << kernel_name << "\n ";
     return EXIT_FAILURE;
   }
 
-  if (kernel_name != "local" && lsz_option->is_set()) {
+  if (kernel_name != "local" && kernel_name != "incremental" && lsz_option->is_set()) {
     std::cout << "Warning: local size provided but kernel used is not \"local\", ignoring --lsz option\n";
   }
 
-  if (lower >= upper) {
-    std::cout << "Error: lower bound can't be greater than the upper bound\n";
-    return EXIT_FAILURE;
+  if (kernel_name != "local" && regs_option->is_set()) {
+    std::cout << "Warning: elements per work-item provided but kernel used is not \"local\", ignoring --regs option\n";
   }
 
-  const unsigned size = (1 << num);
+  if (kernel_name != "incremental" && batch_option->is_set()) {
+    std::cout << "Warning: batch size provided but kernel used is not \"incremental\", ignoring --batch option\n";
+  }
+
+  if (kernel_name == "cpu" && wide_index_option->is_set()) {
+    std::cout << "Warning: kernel used doesn't run on the device, ignoring --wide-index option\n";
+  }
+
+  std::unique_ptr<bitonic::sort_validator<TYPE__, type_name<TYPE__>>> device_validator;
+  if (validate_mode == "device") {
+    device_validator = std::make_unique<bitonic::sort_validator<TYPE__, type_name<TYPE__>>>(base());
+  }
+
+  const std::size_t size = (std::size_t{1} << num);
   const auto print_sep = []() { std::cout << " -------- \n"; };
 
   std::cout << "Sorting vector of size = " << size << "\n";
   print_sep();
 
-  vector_type origin;
-  origin.resize(size);
+  vector_type vec;
+  vec.resize(size);
+  gen.fill(vec);
 
-  auto rand_gen = clutils::create_random_number_generator<TYPE__>(lower, upper);
-  rand_gen(origin);
+  const auto origin_hash = clutils::multiset_hash<TYPE__>(vec);
 
   std::chrono::milliseconds wall;
-  auto check = origin;
 
   if (!skip_std_sort) {
+    auto check = vec;
     auto wall_start = std::chrono::high_resolution_clock::now();
     CPU_SORT(check.begin(), check.end());
     auto wall_end = std::chrono::high_resolution_clock::now();
@@ -237,8 +472,6 @@ int main(int argc, char **argv) try {
   }
 
   clutils::profiling_info prof_info;
-  auto vec = origin;
-
   sorter->sort(vec, &prof_info);
 
   if (!skip_std_sort) std::cout << CPU_SORT_NAME << " wall time: " << wall.count() << " ms\n";
@@ -246,10 +479,22 @@ int main(int argc, char **argv) try {
   std::cout << "bitonic wall time: " << prof_info.wall.count() << " ms\n";
   std::cout << "bitonic pure time: " << prof_info.pure.count() << " ms\n";
 
+  if (validate_mode == "none") {
+    print_sep();
+    return EXIT_SUCCESS;
+  }
+
+  const auto validate_start = std::chrono::high_resolution_clock::now();
+  const auto result = (device_validator ? device_validator->check(std::span<const TYPE__>{vec})
+                                        : clutils::check_sorted<TYPE__>(vec));
+  const auto validate_end = std::chrono::high_resolution_clock::now();
+
+  std::cout << "validation wall time: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(validate_end - validate_start).count() << " ms\n";
+
   print_sep();
 
-  if (skip_std_sort) return EXIT_SUCCESS;
-  return validate_results(origin, vec, check, print_on_failure);
+  return validate_sorted(vec, result, origin_hash, gen, print_on_failure);
 
 } catch (cl::BuildError &e) {
   std::cerr << "Compilation failed:\n";
@@ -0,0 +1,53 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace clutils {
+
+inline unsigned default_thread_count() { return std::max(1u, std::thread::hardware_concurrency()); }
+
+// Split [0, size) into contiguous chunks and call func(begin, end) for each one on a separate thread. Results of the
+// calls are returned in the order of chunks, unless func returns void.
+template <typename F> auto parallel_chunks(std::size_t size, F func, unsigned threads = default_thread_count()) {
+  using result_type = std::invoke_result_t<F, std::size_t, std::size_t>;
+  constexpr bool returns_void = std::is_void_v<result_type>;
+
+  const std::size_t count = std::max<std::size_t>(1, std::min<std::size_t>(threads, size));
+  const std::size_t chunk = size / count, remainder = size % count;
+
+  std::vector<std::conditional_t<returns_void, char, result_type>> results;
+  results.resize(count);
+
+  std::vector<std::thread> workers;
+  workers.reserve(count);
+
+  for (std::size_t i = 0, begin = 0; i < count; ++i) {
+    const std::size_t end = begin + chunk + (i < remainder);
+    workers.emplace_back([&results, &func, i, begin, end]() {
+      if constexpr (returns_void) func(begin, end);
+      else results[i] = func(begin, end);
+    });
+    begin = end;
+  }
+
+  for (auto &w : workers) {
+    w.join();
+  }
+
+  if constexpr (!returns_void) return results;
+}
+
+} // namespace clutils
@@ -0,0 +1,121 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "parallel.hpp"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <span>
+#include <type_traits>
+
+namespace clutils {
+
+// Philox4x32-10 counter-based generator from Salmon et al., "Parallel random numbers: as easy as 1, 2, 3". Every
+// element of the stream is a function of its index and the seed, so any part of the stream can be produced
+// independently: by host threads or by kernels/philox_fill.cl on the device.
+using philox_counter = std::array<std::uint32_t, 4>;
+using philox_key = std::array<std::uint32_t, 2>;
+
+inline philox_counter philox4x32_10(philox_counter ctr, philox_key key) {
+  constexpr std::uint64_t multiplier_0 = 0xD2511F53, multiplier_1 = 0xCD9E8D57;
+  constexpr std::uint32_t weyl_0 = 0x9E3779B9, weyl_1 = 0xBB67AE85;
+
+  for (unsigned round = 0; round < 10; ++round) {
+    if (round) {
+      key[0] += weyl_0;
+      key[1] += weyl_1;
+    }
+
+    const std::uint64_t product_0 = multiplier_0 * ctr[0], product_1 = multiplier_1 * ctr[2];
+    const std::uint32_t hi_0 = product_0 >> 32, lo_0 = product_0, hi_1 = product_1 >> 32, lo_1 = product_1;
+    ctr = {hi_1 ^ ctr[1] ^ key[0], lo_1, hi_0 ^ ctr[3] ^ key[1], lo_0};
+  }
+
+  return ctr;
+}
+
+// 64 random bits for the element at position index of the stream
+inline std::uint64_t philox_bits(std::uint64_t seed, std::uint64_t index) {
+  const philox_counter ctr = {static_cast<std::uint32_t>(index), static_cast<std::uint32_t>(index >> 32), 0, 0};
+  const philox_key key = {static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32)};
+  const auto res = philox4x32_10(ctr, key);
+  return (std::uint64_t{res[1]} << 32) | res[0];
+}
+
+// Bounds are passed to the device kernel as 64-bit integers: sign-extended values for integral types and raw bits for
+// floating point ones
+template <typename T> std::uint64_t encode_bound(T value) {
+  static_assert(std::is_arithmetic_v<T> && sizeof(T) <= sizeof(std::uint64_t));
+  if constexpr (std::is_floating_point_v<T>) {
+    std::uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(T));
+    return bits;
+  } else {
+    return static_cast<std::uint64_t>(value);
+  }
+}
+
+// Number of random bits used for the mantissa of floating point types, 0 for integral ones. It is passed to the kernel
+// as FLOAT_BITS.
+template <typename T> constexpr unsigned philox_float_bits() {
+  if constexpr (std::is_floating_point_v<T>) return std::numeric_limits<T>::digits;
+  else return 0;
+}
+
+// Map random bits to [lower, upper] for integers and [lower, upper) for floating point types. The device kernel does
+// exactly the same operations, fma is used explicitly so that the result doesn't depend on contraction.
+template <typename T> T philox_uniform(std::uint64_t bits, T lower, T upper) {
+  if constexpr (std::is_floating_point_v<T>) {
+    constexpr int float_bits = philox_float_bits<T>();
+    const T unit = std::ldexp(static_cast<T>(bits >> (64 - float_bits)), -float_bits);
+    return std::fma(unit, upper - lower, lower);
+  } else {
+    const std::uint64_t span = encode_bound(upper) - encode_bound(lower) + 1;
+    return static_cast<T>(encode_bound(lower) + (span ? bits % span : bits));
+  }
+}
+
+template <typename T> class counter_based_generator {
+  std::uint64_t m_seed;
+  T m_lower, m_upper;
+
+public:
+  counter_based_generator(T lower, T upper, std::uint64_t seed)
+      : m_seed{seed}, m_lower{lower}, m_upper{upper} {}
+
+  counter_based_generator(T lower, T upper)
+      : counter_based_generator{lower, upper, (std::uint64_t{std::random_device{}()} << 32) | std::random_device{}()} {}
+
+  std::uint64_t seed() const { return m_seed; }
+  T lower() const { return m_lower; }
+  T upper() const { return m_upper; }
+
+  T operator()(std::uint64_t index) const { return philox_uniform(philox_bits(m_seed, index), m_lower, m_upper); }
+
+  // Fill container with elements [offset, offset + size) of the stream
+  void fill(std::span<T> container, std::uint64_t offset = 0, unsigned threads = default_thread_count()) const {
+    parallel_chunks(
+        container.size(),
+        [this, container, offset](std::size_t begin, std::size_t end) {
+          for (std::size_t i = begin; i < end; ++i) {
+            container[i] = operator()(offset + i);
+          }
+        },
+        threads);
+  }
+};
+
+} // namespace clutils
@@ -0,0 +1,62 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <bit>
+#include <cmath>
+#include <cstdint>
+
+namespace clutils {
+
+// Host side of reduced precision storage. Values are kept as raw bits, which is how kernels see them: half through
+// vload_half and bfloat16 as the upper half of a float. Both conversions from float round to nearest even.
+
+inline std::uint16_t float_to_half_bits(float value) {
+  const auto bits = std::bit_cast<std::uint32_t>(value);
+  const std::uint32_t sign = (bits >> 16) & 0x8000u, abs = bits & 0x7fffffffu;
+
+  if (abs > 0x7f800000u) return sign | 0x7e00u;  // NaN
+  if (abs >= 0x477ff000u) return sign | 0x7c00u; // Infinity and everything that rounds up to it
+
+  // Subnormal halves are multiples of 2^-24
+  if (abs < 0x38800000u) {
+    return sign | static_cast<std::uint16_t>(std::nearbyint(std::bit_cast<float>(abs) * 16777216.0f));
+  }
+
+  // Rebias the exponent from 127 to 15 and drop 13 bits of mantissa. Carry from rounding moves into the exponent.
+  std::uint32_t half = (abs - 0x38000000u) >> 13;
+  const std::uint32_t rest = abs & 0x1fffu;
+  if (rest > 0x1000u || (rest == 0x1000u && (half & 1))) ++half;
+  return static_cast<std::uint16_t>(sign | half);
+}
+
+inline float half_bits_to_float(std::uint16_t half) {
+  const std::uint32_t sign = static_cast<std::uint32_t>(half & 0x8000u) << 16;
+  const std::uint32_t exponent = (half >> 10) & 0x1fu, mantissa = half & 0x3ffu;
+
+  if (exponent == 0) {
+    const float abs = std::ldexp(static_cast<float>(mantissa), -24);
+    return (sign ? -abs : abs);
+  }
+
+  if (exponent == 0x1fu) return std::bit_cast<float>(sign | 0x7f800000u | (mantissa << 13));
+  return std::bit_cast<float>(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+inline std::uint16_t float_to_bfloat16_bits(float value) {
+  const auto bits = std::bit_cast<std::uint32_t>(value);
+  if ((bits & 0x7fffffffu) > 0x7f800000u) return static_cast<std::uint16_t>((bits >> 16) | 0x40u); // Keep NaN quiet
+  return static_cast<std::uint16_t>((bits + 0x7fffu + ((bits >> 16) & 1)) >> 16);
+}
+
+inline float bfloat16_bits_to_float(std::uint16_t bf16) { return std::bit_cast<float>(std::uint32_t{bf16} << 16); }
+
+} // namespace clutils
@@ -12,28 +12,39 @@
 
 #include "opencl_include.hpp"
 
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <random>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 namespace clutils {
 
-template <typename T> auto create_random_number_generator(T lower, T upper) {
+// With density below one each element is left zero with probability 1 - density, which gives sparse matrices
+template <typename T> auto create_random_number_generator(T lower, T upper, double density = 1.0) {
+  if (density < 0.0 || density > 1.0) throw std::invalid_argument{"Density should be in [0, 1]"};
+
   std::random_device rnd_device;
   std::mt19937 mersenne_engine{rnd_device()};
 
-  if constexpr (std::is_floating_point_v<T>) {
-    std::uniform_real_distribution<T> dist{lower, upper};
-    return [dist, mersenne_engine](auto &vec) mutable {
-      std::generate(vec.begin(), vec.end(), [&]() { return dist(mersenne_engine); });
+  const auto make_filler = [mersenne_engine, density](auto dist) {
+    std::bernoulli_distribution nonzero{density};
+    return [dist, nonzero, mersenne_engine, density](auto &vec) mutable {
+      std::generate(vec.begin(), vec.end(), [&]() {
+        if (density < 1.0 && !nonzero(mersenne_engine)) return T{0};
+        return dist(mersenne_engine);
+      });
     };
+  };
+
+  if constexpr (std::is_floating_point_v<T>) {
+    return make_filler(std::uniform_real_distribution<T>{lower, upper});
   } else {
-    std::uniform_int_distribution<T> dist{lower, upper};
-    return [dist, mersenne_engine](auto &vec) mutable {
-      std::generate(vec.begin(), vec.end(), [&]() { return dist(mersenne_engine); });
-    };
+    return make_filler(std::uniform_int_distribution<T>{lower, upper});
   }
 }
 
@@ -45,6 +56,15 @@ template <typename... Ts> std::string kernel_define(std::string symbol, Ts... va
   return ss.str();
 }
 
+// Bits of a scalar zero-extended to 64 bits. Kernels take values of a macro-defined TYPE as cl_ulong arguments in this
+// form and reinterpret them back with a union, so that the functor signature doesn't depend on the element type.
+template <typename T> std::uint64_t scalar_bits(T value) {
+  static_assert(std::is_trivially_copyable_v<T> && sizeof(T) <= sizeof(std::uint64_t));
+  std::uint64_t bits = 0;
+  std::memcpy(&bits, &value, sizeof(T));
+  return bits;
+}
+
 template <class T> inline std::size_t sizeof_container(const T &container) {
   return sizeof(typename T::value_type) * container.size();
 }
@@ -0,0 +1,216 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace clutils {
+
+// Finalizer of splitmix64. Kernels that compute the same hash on the device should use the identical function.
+inline std::uint64_t mix_bits(std::uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+}
+
+template <typename T> std::uint64_t element_hash(const T &value) {
+  static_assert(std::is_trivially_copyable_v<T> && sizeof(T) <= sizeof(std::uint64_t),
+                "Only scalar types up to 64 bits can be hashed");
+  std::uint64_t bits = 0;
+  std::memcpy(&bits, &value, sizeof(T));
+  return mix_bits(bits);
+}
+
+// Order independent hash of a multiset: sum of element hashes modulo 2^64. A sequence is a permutation of another one
+// with high probability if both hashes are equal.
+template <typename T>
+std::uint64_t multiset_hash(std::span<const T> container, unsigned threads = default_thread_count()) {
+  const auto partial = parallel_chunks(
+      container.size(),
+      [container](std::size_t begin, std::size_t end) {
+        std::uint64_t hash = 0;
+        for (std::size_t i = begin; i < end; ++i) {
+          hash += element_hash(container[i]);
+        }
+        return hash;
+      },
+      threads);
+
+  return std::accumulate(partial.begin(), partial.end(), std::uint64_t{0});
+}
+
+template <typename T> bool parallel_is_sorted(std::span<const T> container, unsigned threads = default_thread_count()) {
+  const auto partial = parallel_chunks(
+      container.size(),
+      [container](std::size_t begin, std::size_t end) -> char {
+        // Include the first element of the next chunk to check the boundary
+        const auto last = std::min(end + 1, container.size());
+        return std::is_sorted(container.begin() + begin, container.begin() + last);
+      },
+      threads);
+
+  return std::all_of(partial.begin(), partial.end(), [](auto v) { return v; });
+}
+
+struct sort_check_result {
+  bool sorted;
+  std::uint64_t hash;
+};
+
+// Validation in O(n) instead of comparing with a reference sort: the result should be sorted and have the same multiset
+// hash as the input.
+template <typename T>
+sort_check_result check_sorted(std::span<const T> container, unsigned threads = default_thread_count()) {
+  return sort_check_result{parallel_is_sorted(container, threads), multiset_hash(container, threads)};
+}
+
+struct freivalds_result {
+  bool passed;
+  double max_error; // Largest relative residual over rows and rounds, always 0 for integers
+};
+
+// Rounding errors of a sum of k products add up like a random walk, so correct floating point results stay within a few
+// sqrt(k) * eps of the scale of the terms
+template <typename T> double freivalds_tolerance(std::size_t depth) {
+  return 4.0 * std::sqrt(static_cast<double>(std::max<std::size_t>(depth, 1))) * std::numeric_limits<T>::epsilon();
+}
+
+// Freivalds' check that C = A * B for row-major A [ax x ay], B [ay x by] and C [ax x by] in O(n^2) instead of
+// recomputing the product: A * (B * R) is compared with C * R, where columns of R are random vectors, one per round.
+// All rounds go through A, B and C in a single pass. Integers are compared exactly modulo 2^bits of T, which is what
+// wrapping device arithmetic gives, so a wrong result passes a round with probability at most 1/2. Floating point
+// residuals are taken relative to |a_i| * sqrt(sum_j |b_j|^2 * r_j^2), which bounds the magnitude of the terms of row i
+// of C * R by Cauchy-Schwarz.
+template <typename T>
+freivalds_result freivalds_check(std::span<const T> a, std::span<const T> b, std::span<const T> c, std::size_t ax,
+                                 std::size_t ay, std::size_t by, unsigned rounds = 8, double tolerance = -1,
+                                 unsigned threads = default_thread_count()) {
+  if (a.size() != ax * ay || b.size() != ay * by || c.size() != ax * by)
+    throw std::invalid_argument{"Mismatched matrix sizes"};
+  if (!rounds) throw std::invalid_argument{"Freivalds' check needs at least one round"};
+
+  constexpr bool exact = std::is_integral_v<T>;
+  // Integers are multiplied modulo 2^64 and masked to the width of T at the end
+  using acc_type = std::conditional_t<exact, std::uint64_t, double>;
+  const auto convert = [](T value) { return static_cast<acc_type>(value); };
+  if (tolerance < 0) tolerance = freivalds_tolerance<T>(ay);
+
+  std::random_device rnd_device;
+  std::mt19937_64 engine{(std::uint64_t{rnd_device()} << 32) | rnd_device()};
+  std::uniform_real_distribution<double> real{-1.0, 1.0};
+
+  // R is by x rounds, row-major
+  std::vector<acc_type> r(by * rounds);
+  std::generate(r.begin(), r.end(), [&]() {
+    if constexpr (exact) return engine();
+    else return real(engine);
+  });
+
+  // B * R and squared norms of columns of B for the floating point scale
+  std::vector<acc_type> br(ay * rounds);
+  const auto column_norms = parallel_chunks(
+      ay,
+      [&](std::size_t begin, std::size_t end) {
+        std::vector<double> norms(exact ? 0 : by);
+        for (std::size_t k = begin; k < end; ++k) {
+          for (std::size_t j = 0; j < by; ++j) {
+            const auto value = convert(b[k * by + j]);
+            for (unsigned t = 0; t < rounds; ++t) {
+              br[k * rounds + t] += value * r[j * rounds + t];
+            }
+            if constexpr (!exact) norms[j] += value * value;
+          }
+        }
+        return norms;
+      },
+      threads);
+
+  // sum_j |b_j|^2 * r_j^2 for every round
+  std::vector<double> weights(rounds);
+  if constexpr (!exact) {
+    for (std::size_t j = 0; j < by; ++j) {
+      double norm = 0;
+      for (const auto &chunk : column_norms) {
+        norm += chunk[j];
+      }
+      for (unsigned t = 0; t < rounds; ++t) {
+        weights[t] += norm * r[j * rounds + t] * r[j * rounds + t];
+      }
+    }
+  }
+
+  const auto partial = parallel_chunks(
+      ax,
+      [&](std::size_t begin, std::size_t end) {
+        freivalds_result res = {true, 0.0};
+        std::vector<acc_type> lhs(rounds), rhs(rounds);
+        for (std::size_t i = begin; i < end; ++i) {
+          std::fill(lhs.begin(), lhs.end(), acc_type{0});
+          std::fill(rhs.begin(), rhs.end(), acc_type{0});
+          double row_norm = 0;
+
+          for (std::size_t k = 0; k < ay; ++k) {
+            const auto value = convert(a[i * ay + k]);
+            for (unsigned t = 0; t < rounds; ++t) {
+              lhs[t] += value * br[k * rounds + t];
+            }
+            if constexpr (!exact) row_norm += value * value;
+          }
+
+          for (std::size_t j = 0; j < by; ++j) {
+            const auto value = convert(c[i * by + j]);
+            for (unsigned t = 0; t < rounds; ++t) {
+              rhs[t] += value * r[j * rounds + t];
+            }
+          }
+
+          for (unsigned t = 0; t < rounds; ++t) {
+            if constexpr (exact) {
+              constexpr std::uint64_t mask =
+                  (sizeof(T) >= sizeof(std::uint64_t) ? ~std::uint64_t{0} : (std::uint64_t{1} << 8 * sizeof(T)) - 1);
+              if ((lhs[t] - rhs[t]) & mask) res.passed = false;
+            } else {
+              const auto residual = std::abs(lhs[t] - rhs[t]), scale = std::sqrt(row_norm * weights[t]);
+              const auto error = (scale > 0 ? residual / scale : residual);
+              // Written so that NaNs fail the check
+              if (!(error <= tolerance)) res.passed = false;
+              res.max_error = std::max(res.max_error, error);
+            }
+          }
+        }
+        return res;
+      },
+      threads);
+
+  freivalds_result res = {true, 0.0};
+  for (const auto &chunk : partial) {
+    res.passed = res.passed && chunk.passed;
+    res.max_error = std::max(res.max_error, chunk.max_error);
+  }
+  return res;
+}
+
+} // namespace clutils
@@ -0,0 +1,147 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#define STRINGIFY0(v) #v
+#define STRINGIFY(v) STRINGIFY0(v)
+
+#ifndef TYPE__
+#define TYPE__ int
+#endif
+
+#include "conv.hpp"
+#include "utils.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "popl.hpp"
+
+using matrix_type = matmult::host_matrix<TYPE__>;
+
+template <typename T> struct type_name {};
+template <> struct type_name<TYPE__> {
+  static constexpr const char *name_str = STRINGIFY(TYPE__);
+};
+
+using conv2d_matmult = matmult::conv2d_matmult<TYPE__, type_name<TYPE__>>;
+
+int main(int argc, char *argv[]) try {
+  popl::OptionParser op("Avaliable options");
+  auto help_option = op.add<popl::Switch>("h", "help", "Print this help message");
+  auto skip_option = op.add<popl::Switch>("s", "skip", "Skip cpu calculation");
+
+  auto lower_option = op.add<popl::Implicit<TYPE__>>("l", "lower", "Lower bound", -8);
+  auto upper_option = op.add<popl::Implicit<TYPE__>>("u", "upper", "Upper bound", +8);
+
+  auto batch_option = op.add<popl::Implicit<unsigned>>("n", "batch", "Number of images", 8);
+  auto channels_option = op.add<popl::Implicit<unsigned>>("c", "channels", "Number of input channels", 64);
+  auto height_option = op.add<popl::Implicit<unsigned>>("", "height", "Height of an image", 56);
+  auto width_option = op.add<popl::Implicit<unsigned>>("", "width", "Width of an image", 56);
+  auto filters_option = op.add<popl::Implicit<unsigned>>("k", "filters", "Number of filters", 64);
+  auto fsize_option = op.add<popl::Implicit<unsigned>>("r", "fsize", "Height and width of a filter", 3);
+  auto stride_option = op.add<popl::Implicit<unsigned>>("", "stride", "Stride of the filter", 1);
+  auto padding_option = op.add<popl::Implicit<unsigned>>("", "padding", "Zero padding on every side of an image", 1);
+
+  auto lsz_option = op.add<popl::Implicit<unsigned>>("", "lsz", "Tile size of the tiledarb kernel", 16);
+  auto prefetch_option =
+      op.add<popl::Switch>("", "prefetch", "Double buffer tiles and prefetch the next ones in the tiledarb kernel");
+
+  op.parse(argc, argv);
+
+  if (help_option->is_set()) {
+    std::cout << op << "\n ";
+    return EXIT_SUCCESS;
+  }
+
+  const auto lower = lower_option->value(), upper = upper_option->value();
+  if (lower >= upper) {
+    std::cout << "Error: lower bound can't be greater than the upper bound\n";
+    return EXIT_FAILURE;
+  }
+
+  if (!matmult::gpu_matmult<TYPE__>::available()) {
+    std::cout << "Error: no suitable OpenCL device found\n";
+    return EXIT_FAILURE;
+  }
+
+  const matmult::conv_shape shape = {.batch = batch_option->value(),
+                                     .channels = channels_option->value(),
+                                     .height = height_option->value(),
+                                     .width = width_option->value(),
+                                     .filters = filters_option->value(),
+                                     .filter_height = fsize_option->value(),
+                                     .filter_width = fsize_option->value(),
+                                     .stride = stride_option->value(),
+                                     .padding = padding_option->value()};
+  shape.validate();
+
+  const auto print_sep = []() { std::cout << " -------- \n"; };
+  std::cout << "Convolving " << shape.batch << " images [" << shape.channels << " x " << shape.height << " x "
+            << shape.width << "] with " << shape.filters << " filters [" << shape.channels << " x "
+            << shape.filter_height << " x " << shape.filter_width << "], stride " << shape.stride << ", padding "
+            << shape.padding << "\n";
+  std::cout << "Output [" << shape.filters << " x " << shape.out_height() << " x " << shape.out_width()
+            << "], im2col GEMM of [" << shape.filters << " x " << shape.depth() << "] by [" << shape.depth() << " x "
+            << shape.batch * shape.out_pixels() << "]\n";
+  print_sep();
+
+  matrix_type input{shape.batch, shape.image_size()}, filters{shape.filters, shape.depth()};
+  auto random_filler = clutils::create_random_number_generator<TYPE__>(lower, upper);
+  random_filler(input);
+  random_filler(filters);
+
+  const auto print_time = [flop = shape.flop()](auto name, std::chrono::milliseconds time) {
+    std::cout << name << " time: " << time.count() << " ms";
+    if (time.count()) std::cout << " (" << flop / time.count() / 1e6 << " GFLOP/s)";
+    std::cout << "\n";
+  };
+
+  conv2d_matmult conv{lsz_option->value(), prefetch_option->is_set()};
+  clutils::profiling_info prof_info;
+  const auto res = conv.convolve(shape, input, filters, &prof_info);
+
+  print_time("GPU wall", prof_info.wall);
+  print_time("GPU pure", prof_info.pure);
+
+  if (skip_option->is_set()) return EXIT_SUCCESS;
+
+  auto wall_start = std::chrono::high_resolution_clock::now();
+  const auto reference = matmult::cpu_conv2d(shape, input, filters);
+  auto wall_end = std::chrono::high_resolution_clock::now();
+
+  const auto wall_cpu = std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start);
+  print_time("CPU direct wall", wall_cpu);
+  if (prof_info.wall.count()) {
+    std::cout << "Speedup over CPU: " << static_cast<double>(wall_cpu.count()) / prof_info.wall.count() << "\n";
+  }
+
+  print_sep();
+
+  if (res == reference) {
+    std::cout << "GPU convolution works fine\n";
+    return EXIT_SUCCESS;
+  }
+
+  std::cout << "GPU convolution is borked\n";
+  return EXIT_FAILURE;
+} catch (cl::BuildError &e) {
+  std::cerr << "Compilation failed:\n";
+  for (const auto &v : e.getBuildLog()) {
+    std::cerr << v.second << "\n";
+  }
+} catch (cl::Error &e) {
+  std::cerr << "OpenCL error: " << e.what() << "(" << e.err() << ")\n";
+} catch (std::exception &e) {
+  std::cerr << "Encountered error: " << e.what() << "\n";
+} catch (...) {
+  std::cerr << "Unknown error\n";
+}
@@ -12,22 +12,141 @@
 
 #include "opencl_include.hpp"
 #include "selector.hpp"
+#include "philox.hpp"
 #include "utils.hpp"
+#include "validation.hpp"
 
+#include <algorithm>
+#include <array>
 #include <bit>
 #include <chrono>
+#include <cstdint>
+#include <limits>
+#include <functional>
 #include <memory>
+#include <numeric>
+#include <optional>
 #include <span>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 #include "kernelhpp/bitonic_local_initial_kernel.hpp"
+#include "kernelhpp/bitonic_local_register_kernel.hpp"
+#include "kernelhpp/bitonic_local_subgroup_kernel.hpp"
+#include "kernelhpp/bitonic_merge_sorted_kernel.hpp"
 #include "kernelhpp/bitonic_naive_kernel.hpp"
+#include "kernelhpp/bitonic_topk_reduce_kernel.hpp"
+#include "kernelhpp/philox_fill_kernel.hpp"
+#include "kernelhpp/sort_validate_kernel.hpp"
 
 namespace bitonic {
 
+// Functor of a kernel built with the given INDEX_TYPE. Kernels with INDEX_TYPE arguments take cl_uint or cl_ulong for
+// them, the others have the same functor for both.
+template <typename t_kernel, typename t_index> struct indexed_functor {
+  using type = typename t_kernel::functor_type;
+};
+
+template <typename t_kernel, typename t_index>
+  requires requires { typename t_kernel::template indexed_functor_type<t_index>; }
+struct indexed_functor<t_kernel, t_index> {
+  using type = typename t_kernel::template indexed_functor_type<t_index>;
+};
+
+// Kernels index buffers with 32-bit integers unless the sequence is too long for that. The 64-bit version of a kernel
+// is compiled on first use, so the common case doesn't pay for the extra compilation and arithmetic.
+template <typename t_kernel> class indexed_kernel {
+public:
+  using narrow_functor_type = typename indexed_functor<t_kernel, cl_uint>::type;
+  using wide_functor_type = typename indexed_functor<t_kernel, cl_ulong>::type;
+  using source_func = std::function<std::string(std::string)>;
+
+private:
+  template <typename t_functor> struct compiled_kernel {
+    cl::Program program;
+    t_functor functor;
+  };
+
+  cl::Context m_ctx;
+  source_func m_source;
+  std::string m_entry, m_options;
+  compiled_kernel<narrow_functor_type> m_narrow;
+  std::optional<compiled_kernel<wide_functor_type>> m_wide;
+  bool m_always_wide = false;
+
+  template <typename t_functor>
+  static compiled_kernel<t_functor> compile(cl::Context ctx, const std::string &source, const std::string &entry,
+                                            const std::string &options) {
+    if (options.empty()) {
+      cl::Program program = {ctx, source, true};
+      return compiled_kernel<t_functor>{program, t_functor{program, entry}};
+    }
+
+    cl::Program program = {ctx, source};
+    program.build(options.c_str());
+    return compiled_kernel<t_functor>{program, t_functor{program, entry}};
+  }
+
+  wide_functor_type &wide() {
+    if (!m_wide) m_wide = compile<wide_functor_type>(m_ctx, m_source("ulong"), m_entry, m_options);
+    return m_wide->functor;
+  }
+
+public:
+  static bool requires_wide_index(std::size_t size) { return size > std::numeric_limits<cl_uint>::max(); }
+
+  bool uses_wide_index(std::size_t size) const { return m_always_wide || requires_wide_index(size); }
+
+  // Entry can be overridden to use another kernel with the same signature. Build options replace the defaults of
+  // cl::Program when given.
+  indexed_kernel(cl::Context ctx, source_func source, std::string entry = t_kernel::entry(), std::string options = {})
+      : m_ctx{ctx}, m_source{source}, m_entry{entry}, m_options{options},
+        m_narrow{compile<narrow_functor_type>(ctx, source("uint"), entry, options)} {}
+
+  // Functor suitable to process a buffer of size elements, for kernels whose arguments don't depend on INDEX_TYPE
+  narrow_functor_type &get(std::size_t size)
+    requires std::is_same_v<narrow_functor_type, wide_functor_type>
+  {
+    if (!uses_wide_index(size)) return m_narrow.functor;
+    return wide();
+  }
+
+  // Enqueue the variant suitable to process a buffer of size elements. Arguments typed as INDEX_TYPE are converted to
+  // cl_uint or cl_ulong, so the 32-bit variant doesn't do 64-bit arithmetic on them.
+  template <typename... t_args> cl::Event run(std::size_t size, const cl::EnqueueArgs &args, t_args &&...params) {
+    if (!uses_wide_index(size)) return m_narrow.functor(args, std::forward<t_args>(params)...);
+    return wide()(args, std::forward<t_args>(params)...);
+  }
+
+  // Compile the 64-bit variant now instead of on first use, so that a build error is thrown here
+  void build_wide() { wide(); }
+
+  // Use the 64-bit variant for every size, so that it can be tested on short sequences. It is compiled right away.
+  void force_wide_index() {
+    m_always_wide = true;
+    build_wide();
+  }
+};
+
+enum class subgroup_support { none, khr, intel };
+
+// Sub-group shuffles are available either through the Khronos extensions or through the older Intel one
+inline subgroup_support query_subgroup_support(cl::Device device) {
+  const std::array<std::string, 2> khr_extensions = {"cl_khr_subgroups", "cl_khr_subgroup_shuffle"};
+  if (clutils::device_supports_extensions(device, khr_extensions.begin(), khr_extensions.end()).first)
+    return subgroup_support::khr;
+
+  const std::array<std::string, 1> intel_extensions = {"cl_intel_subgroups"};
+  if (clutils::device_supports_extensions(device, intel_extensions.begin(), intel_extensions.end()).first)
+    return subgroup_support::intel;
+
+  return subgroup_support::none;
+}
+
 template <typename T> struct i_bitonic_sort {
-  using size_type = unsigned;
+  using size_type = std::size_t;
   void sort(std::span<T> container, clutils::profiling_info *time = nullptr) { return operator()(container, time); }
   virtual void operator()(std::span<T>, clutils::profiling_info *) = 0;
   virtual ~i_bitonic_sort() {}
@@ -41,7 +160,7 @@ template <typename T> struct cpu_bitonic_sort : public i_bitonic_sort<T> {
     if (std::popcount(size) != 1 || size < 2) throw std::runtime_error{"Only power-of-two sequences are supported"};
 
     const auto execute_step = [container, size](size_type stage, size_type step) {
-      const size_type part_length = 1 << (step + 1);
+      const size_type part_length = size_type{1} << (step + 1);
 
       const auto calc_j = [stage, step, part_length](auto i) -> size_type {
         if (stage == step) return part_length - i - 1;
@@ -77,6 +196,7 @@ template <typename T> class gpu_bitonic : public i_bitonic_sort<T>, protected cl
 protected:
   cl::Context m_ctx;
   cl::CommandQueue m_queue;
+  bool m_wide_index = false;
 
   using typename i_bitonic_sort<T>::size_type;
   static constexpr clutils::platform_version cl_api_version = {2, 2};
@@ -88,6 +208,14 @@ public:
 
   template <long t_info> auto get_device_info() const { return m_device.getInfo<t_info>(); }
 
+  // Sorters built from this base use kernels with 64-bit indices for sequences of any length
+  void force_wide_index() { m_wide_index = true; }
+
+  // Copy the first container.size() elements of a buffer created in this context to the host
+  void download(cl::Buffer buf, std::span<T> container) const {
+    cl::copy(m_queue, buf, container.begin(), container.end());
+  }
+
 private:
   void operator()(std::span<T>, clutils::profiling_info *) override {
   } // Dummy override so that the class is no longer abstract
@@ -95,7 +223,13 @@ private:
 protected:
   using func_signature = cl::Event(cl::Buffer);
 
+  void check_allocation_size(std::size_t bin_size) const {
+    if (bin_size > m_device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>())
+      throw std::runtime_error{"Sequence doesn't fit into a single device memory allocation"};
+  }
+
   void run_boilerplate(std::span<T> container, std::function<func_signature> func) {
+    check_allocation_size(clutils::sizeof_container(container));
     cl::Buffer buf = {m_ctx, CL_MEM_READ_WRITE, clutils::sizeof_container(container)};
     cl::copy(m_queue, container.begin(), container.end(), buf);
 
@@ -110,8 +244,7 @@ template <typename T, typename t_name> class naive_bitonic : public gpu_bitonic<
   using kernel = bitonic_naive_kernel;
 
 private:
-  cl::Program m_program;
-  typename kernel::functor_type m_functor;
+  indexed_kernel<kernel> m_kernel;
 
   using gpu_bitonic<T>::m_queue;
   using gpu_bitonic<T>::m_ctx;
@@ -121,8 +254,11 @@ private:
 
 public:
   naive_bitonic(gpu_bitonic<T> base)
-      : gpu_bitonic<T>{base}, m_program{m_ctx, kernel::source(t_name::name_str), true}, m_functor{m_program,
-                                                                                                  kernel::entry()} {}
+      : gpu_bitonic<T>{base}, m_kernel{m_ctx, [](auto index_type) {
+          return kernel::source(t_name::name_str, index_type);
+        }} {
+    if (this->m_wide_index) m_kernel.force_wide_index();
+  }
 
   naive_bitonic(bool verbose) : naive_bitonic{gpu_bitonic<T>{verbose}} {}
 
@@ -130,19 +266,20 @@ public:
     const size_type size = container.size(), stages = std::countr_zero(size);
     if (std::popcount(size) != 1 || size < 2) throw std::runtime_error("Only power-of-two sequences are supported");
     cl::Event prev_event, first_event;
+    auto &functor = m_kernel.get(size);
 
     auto submit = [&, first_iter = true](auto buf, auto stage, auto step) mutable {
       const auto global_size = size / 2;
 
       if (first_iter) {
         const auto args = cl::EnqueueArgs{m_queue, global_size};
-        first_event = prev_event = m_functor(args, buf, stage, step);
+        first_event = prev_event = functor(args, buf, stage, step);
         first_iter = false;
         return;
       }
 
       const auto args = cl::EnqueueArgs{m_queue, prev_event, global_size};
-      prev_event = m_functor(args, buf, stage, step);
+      prev_event = functor(args, buf, stage, step);
     };
 
     const auto func = [&, stages](auto buf) {
@@ -170,82 +307,507 @@ public:
 
 template <typename T, typename t_name> class local_bitonic : public gpu_bitonic<T> {
   using kernel_initial = bitonic_local_initial_kernel;
+  using kernel_subgroup = bitonic_local_subgroup_kernel;
+  using kernel_register = bitonic_local_register_kernel;
   using kernel_naive = bitonic_naive_kernel;
 
+  static_assert(std::is_same_v<typename kernel_initial::functor_type, typename kernel_subgroup::functor_type>,
+                "Sub-group kernel should be a drop-in replacement for local_initial");
+  static_assert(std::is_same_v<typename kernel_initial::functor_type, typename kernel_register::functor_type>,
+                "Register kernel should be a drop-in replacement for local_initial");
+
 private:
-  cl::Program m_program_initial, m_program_last;
-  typename kernel_initial::functor_type m_functor_initial;
-  typename kernel_naive::functor_type m_functor_last;
+  indexed_kernel<kernel_initial> m_kernel_initial;
+  indexed_kernel<kernel_naive> m_kernel_last;
 
+protected:
   using gpu_bitonic<T>::m_ctx;
   using gpu_bitonic<T>::m_queue;
   using gpu_bitonic<T>::run_boilerplate;
 
   using typename gpu_bitonic<T>::size_type;
-  size_type m_local_size = 0;
+  size_type m_local_size = 0, m_elems_per_item = 2;
+
+  using gpu_bitonic<T>::m_device;
+
+  // With more than 2 elements per work-item use the register kernel. Otherwise use sub-group shuffles for short strides
+  // when the device supports them and fall back to local_initial if it doesn't or the sub-group kernel fails to build.
+  // Both index widths of the sub-group kernel are built here, so that the fallback also covers the 64-bit one instead of
+  // a build error in the middle of a long sort.
+  static indexed_kernel<kernel_initial> make_initial_kernel(cl::Context ctx, cl::Device device,
+                                                            const size_type segment_size,
+                                                            const size_type elems_per_item) {
+    if (elems_per_item != 2) {
+      return {ctx,
+              [segment_size, elems_per_item](auto index_type) {
+                return kernel_register::source(t_name::name_str, segment_size, index_type, elems_per_item);
+              },
+              kernel_register::entry()};
+    }
 
-public:
-  local_bitonic(const size_type segment_size, gpu_bitonic<T> base)
-      : gpu_bitonic<T>{base}, m_program_initial{m_ctx, kernel_initial::source(t_name::name_str, segment_size), true},
-        m_program_last{m_ctx, kernel_naive::source(t_name::name_str), true}, m_functor_initial{m_program_initial,
-                                                                                               kernel_initial::entry()},
-        m_functor_last{m_program_last, kernel_naive::entry()}, m_local_size{segment_size} {
+    const auto local_initial = [ctx, segment_size]() -> indexed_kernel<kernel_initial> {
+      return {ctx, [segment_size](auto index_type) {
+                return kernel_initial::source(t_name::name_str, segment_size, index_type);
+              }};
+    };
+
+    const auto support = query_subgroup_support(device);
+    if (support == subgroup_support::none) return local_initial();
+
+    // Khronos shuffles are OpenCL C 2.0 built-ins, the Intel ones are available in any version
+    const unsigned intel = (support == subgroup_support::intel);
+    try {
+      indexed_kernel<kernel_initial> res = {ctx,
+                                            [segment_size, intel](auto index_type) {
+                                              return kernel_subgroup::source(t_name::name_str, segment_size,
+                                                                             index_type, intel);
+                                            },
+                                            kernel_subgroup::entry(), (intel ? "" : "-cl-std=CL2.0")};
+      res.build_wide();
+      return res;
+    } catch (cl::BuildError &) {
+      return local_initial();
+    }
+  }
+
+  // Checked before the kernels are built for these sizes, which would fail with a build log or waste a compilation
+  static size_type validate(const size_type segment_size, const size_type elems_per_item) {
     if (std::popcount(segment_size) != 1 || segment_size < 2)
       throw std::runtime_error{"Segment size must be a natural power of 2"};
+    if (elems_per_item != 2 && elems_per_item != 4 && elems_per_item != 8 && elems_per_item != 16)
+      throw std::runtime_error{"Number of elements per work-item must be 2, 4, 8 or 16"};
+    if (segment_size < elems_per_item)
+      throw std::runtime_error{"Segment size can't be less than the number of elements per work-item"};
+    return segment_size;
   }
 
-  local_bitonic(const unsigned segment_size, bool verbose) : local_bitonic{segment_size, gpu_bitonic<T>{verbose}} {}
+  cl::Event m_first_event, m_last_event;
+  bool m_chain_started = false;
 
-  void operator()(std::span<T> container, clutils::profiling_info *time = nullptr) override {
-    const size_type size = container.size(), stages = std::countr_zero(size),
-                    initial_stages = std::countr_zero(m_local_size);
-    if (std::popcount(size) != 1 || size < 2) throw std::runtime_error{"Only power-of-two sequences are supported"};
-    if (size < m_local_size) throw std::runtime_error{"Total size can't be less than local size"};
+  void reset_chain() { m_chain_started = false; }
 
-    cl::Event prev_event, first_event;
-    const auto initial_end_stage = std::min(initial_stages, stages);
+  void submit(cl::Event event) {
+    if (!m_chain_started) {
+      m_first_event = event;
+      m_chain_started = true;
+    }
+    m_last_event = event;
+  }
 
-    auto enqueue_initial = [&](auto buf) {
-      auto args = cl::EnqueueArgs{m_queue, size / 2, m_local_size / 2};
-      first_event = prev_event = m_functor_initial(args, buf, 0, initial_end_stage, 0);
-    };
+  // A chain may have nothing to enqueue, such as a top-k of a single run. A marker then gives it valid events, so that
+  // waiting and profiling don't touch a null event or one left from the previous chain.
+  void finish_chain() {
+    if (m_chain_started) return;
+    cl::Event marker;
+    m_queue.enqueueMarkerWithWaitList(nullptr, &marker);
+    submit(marker);
+  }
 
-    auto enqueue_last = [&](auto buf) {
-      for (unsigned stage = initial_end_stage; stage < stages; ++stage) {
-        for (int step = stage; step >= 0; --step) {
-          const size_type global_size = size / 2;
-          const size_type part_length = 1 << (step + 1);
+  cl::EnqueueArgs local_args(size_type size) const {
+    return cl::EnqueueArgs{m_queue, size / m_elems_per_item, m_local_size / m_elems_per_item};
+  }
 
-          if (part_length <= m_local_size) {
-            const auto args = cl::EnqueueArgs{m_queue, size / 2, m_local_size / 2};
-            prev_event = m_functor_initial(args, buf, stage, stage + 1, stage - step);
-            break;
-          }
+  // Perform steps [first_step, 0] of the given stage. When stage != first_step this is a plain bitonic merge of
+  // sequences of length 2^(first_step + 1), because the flipping compare is only done for the first step of a stage.
+  void enqueue_merge(cl::Buffer buf, size_type size, size_type stage, size_type first_step) {
+    const bool use_local = (size >= m_local_size);
 
-          const auto args = cl::EnqueueArgs{m_queue, prev_event, global_size};
-          prev_event = m_functor_last(args, buf, stage, step);
-        }
+    for (int step = first_step; step >= 0; --step) {
+      const size_type part_length = size_type{1} << (step + 1);
+
+      if (use_local && part_length <= m_local_size) {
+        const auto args = local_args(size);
+        submit(m_kernel_initial.get(size)(args, buf, stage, stage + 1, stage - step));
+        return;
       }
-    };
+
+      const auto args = cl::EnqueueArgs{m_queue, size / 2};
+      submit(m_kernel_last.get(size)(args, buf, stage, step));
+    }
+  }
+
+  // Sort consecutive runs of 2^stages elements in ascending order
+  void enqueue_sort(cl::Buffer buf, size_type size, size_type stages) {
+    size_type stage = 0;
+
+    if (size >= m_local_size) {
+      stage = std::min<size_type>(std::countr_zero(m_local_size), stages);
+      if (stage) {
+        const auto args = local_args(size);
+        submit(m_kernel_initial.get(size)(args, buf, 0, stage, 0));
+      }
+    }
+
+    for (; stage < stages; ++stage) {
+      enqueue_merge(buf, size, stage, stage);
+    }
+  }
+
+  void fill_profiling_info(clutils::profiling_info *time, auto wall_start, auto wall_end) const {
+    if (!time) return;
+
+    const std::chrono::nanoseconds pure_start{m_first_event.template getProfilingInfo<CL_PROFILING_COMMAND_START>()},
+        pure_end{m_last_event.template getProfilingInfo<CL_PROFILING_COMMAND_END>()};
+
+    time->wall = std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start);
+    time->pure = std::chrono::duration_cast<std::chrono::milliseconds>(pure_end - pure_start);
+  }
+
+public:
+  // Each work-item of the local kernel handles elems_per_item elements. Values above 2 (4, 8 or 16) presort that many
+  // elements in registers, which allows longer segments for the same work-group size.
+  local_bitonic(const size_type segment_size, gpu_bitonic<T> base, const size_type elems_per_item = 2)
+      : gpu_bitonic<T>{base},
+        m_kernel_initial{make_initial_kernel(m_ctx, m_device, validate(segment_size, elems_per_item), elems_per_item)},
+        m_kernel_last{m_ctx, [](auto index_type) { return kernel_naive::source(t_name::name_str, index_type); }},
+        m_local_size{segment_size}, m_elems_per_item{elems_per_item} {
+    if (this->m_wide_index) {
+      m_kernel_initial.force_wide_index();
+      m_kernel_last.force_wide_index();
+    }
+  }
+
+  local_bitonic(const unsigned segment_size, bool verbose, const unsigned elems_per_item = 2)
+      : local_bitonic{segment_size, gpu_bitonic<T>{verbose}, elems_per_item} {}
+
+  void operator()(std::span<T> container, clutils::profiling_info *time = nullptr) override {
+    const size_type size = container.size();
+    check_sort_size(size);
 
     const auto func = [&](auto buf) {
-      enqueue_initial(buf);
-      enqueue_last(buf);
-      return prev_event;
+      reset_chain();
+      enqueue_sort(buf, size, std::countr_zero(size));
+      return m_last_event;
     };
 
     const auto wall_start = std::chrono::high_resolution_clock::now();
     run_boilerplate(container, func);
     const auto wall_end = std::chrono::high_resolution_clock::now();
 
-    const std::chrono::nanoseconds pure_start{first_event.getProfilingInfo<CL_PROFILING_COMMAND_START>()},
-        pure_end{prev_event.getProfilingInfo<CL_PROFILING_COMMAND_END>()};
+    fill_profiling_info(time, wall_start, wall_end);
+  }
 
-    if (time) {
-      time->wall = std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start);
-      time->pure = std::chrono::duration_cast<std::chrono::milliseconds>(pure_end - pure_start);
+  // Sort size elements of a buffer that already lives in device memory, without transfers. The buffer should be created
+  // in the context of the base object.
+  void sort(cl::Buffer buf, const size_type size, clutils::profiling_info *time = nullptr) {
+    check_sort_size(size);
+
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    reset_chain();
+    enqueue_sort(buf, size, std::countr_zero(size));
+    m_last_event.wait();
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+
+    fill_profiling_info(time, wall_start, wall_end);
+  }
+
+  using i_bitonic_sort<T>::sort;
+
+private:
+  void check_sort_size(const size_type size) const {
+    if (std::popcount(size) != 1 || size < 2) throw std::runtime_error{"Only power-of-two sequences are supported"};
+    if (size < m_local_size) throw std::runtime_error{"Total size can't be less than local size"};
+  }
+};
+
+enum class topk_order { smallest, largest };
+
+// Selects k best elements without sorting the whole sequence. Runs of length k are sorted first, then adjacent runs are
+// merged pairwise and only the best half of each pair is kept, so the amount of data halves on every level.
+template <typename T, typename t_name> class topk_bitonic : public local_bitonic<T, t_name> {
+  using kernel_reduce = bitonic_topk_reduce_kernel;
+
+private:
+  indexed_kernel<kernel_reduce> m_kernel_reduce;
+  topk_order m_order;
+
+  using local_bitonic<T, t_name>::m_ctx;
+  using local_bitonic<T, t_name>::m_queue;
+  using local_bitonic<T, t_name>::m_last_event;
+
+  using local_bitonic<T, t_name>::reset_chain;
+  using local_bitonic<T, t_name>::submit;
+  using local_bitonic<T, t_name>::enqueue_merge;
+  using local_bitonic<T, t_name>::enqueue_sort;
+  using local_bitonic<T, t_name>::finish_chain;
+  using local_bitonic<T, t_name>::fill_profiling_info;
+
+  using typename local_bitonic<T, t_name>::size_type;
+
+  static std::string select_function(topk_order order) { return (order == topk_order::smallest ? "min" : "max"); }
+
+public:
+  topk_bitonic(const size_type segment_size, topk_order order, gpu_bitonic<T> base)
+      : local_bitonic<T, t_name>{segment_size, base},
+        m_kernel_reduce{m_ctx,
+                        [order](auto index_type) {
+                          return kernel_reduce::source(t_name::name_str, select_function(order), index_type);
+                        }},
+        m_order{order} {
+    if (this->m_wide_index) m_kernel_reduce.force_wide_index();
+  }
+
+  topk_bitonic(const unsigned segment_size, topk_order order, bool verbose)
+      : topk_bitonic{segment_size, order, gpu_bitonic<T>{verbose}} {}
+
+  // Returns k best elements ordered from the best one: ascending for topk_order::smallest and descending for
+  // topk_order::largest.
+  std::vector<T> select(std::span<const T> container, size_type k, clutils::profiling_info *time = nullptr) {
+    const size_type n = container.size();
+    if (k == 0 || k > n) throw std::invalid_argument{"k should be in range [1, size]"};
+
+    const size_type run_length = std::bit_ceil(k), run_stages = std::countr_zero(run_length);
+    size_type size = std::bit_ceil(n);
+
+    // Padding elements never make it into the answer, unless they are equal to the ones that should.
+    const T padding =
+        (m_order == topk_order::smallest ? std::numeric_limits<T>::max() : std::numeric_limits<T>::lowest());
+
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+
+    this->check_allocation_size(size * sizeof(T));
+    cl::Buffer src = {m_ctx, CL_MEM_READ_WRITE, size * sizeof(T)};
+    cl::Buffer dst = {m_ctx, CL_MEM_READ_WRITE, size / 2 * sizeof(T)};
+
+    cl::copy(m_queue, container.begin(), container.end(), src);
+    if (size != n) m_queue.enqueueFillBuffer(src, padding, n * sizeof(T), (size - n) * sizeof(T));
+
+    reset_chain();
+    enqueue_sort(src, size, run_stages);
+
+    for (; size > run_length; size /= 2) {
+      const auto args = cl::EnqueueArgs{m_queue, size / 2};
+      submit(m_kernel_reduce.run(size, args, src, dst, run_length));
+      // Best halves are bitonic sequences of length run_length, so a single merge without the flip is enough
+      if (run_stages) enqueue_merge(dst, size / 2, run_stages, run_stages - 1);
+      std::swap(src, dst);
+    }
+
+    finish_chain();
+    m_last_event.wait();
+
+    std::vector<T> result;
+    result.resize(run_length);
+    cl::copy(m_queue, src, result.begin(), result.end());
+
+    if (m_order == topk_order::smallest) {
+      result.resize(k);
+    } else {
+      std::reverse(result.begin(), result.end());
+      result.resize(k);
+    }
+
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+    fill_profiling_info(time, wall_start, wall_end);
+
+    return result;
+  }
+};
+
+// Sorted sequence that lives in device memory. New batches are sorted on their own and then merged into the resident
+// data in a single pass, so the cost of an insertion doesn't depend on the number of full sorts done before.
+template <typename T, typename t_name> class sorted_device_array : public local_bitonic<T, t_name> {
+  using kernel_merge = bitonic_merge_sorted_kernel;
+
+private:
+  indexed_kernel<kernel_merge> m_kernel_merge;
+
+  using local_bitonic<T, t_name>::m_ctx;
+  using local_bitonic<T, t_name>::m_queue;
+  using local_bitonic<T, t_name>::m_last_event;
+
+  using local_bitonic<T, t_name>::reset_chain;
+  using local_bitonic<T, t_name>::submit;
+  using local_bitonic<T, t_name>::enqueue_sort;
+  using local_bitonic<T, t_name>::fill_profiling_info;
+
+  using typename local_bitonic<T, t_name>::size_type;
+
+  cl::Buffer m_data, m_scratch;
+  size_type m_size = 0, m_data_capacity = 0, m_scratch_capacity = 0;
+
+public:
+  sorted_device_array(const size_type segment_size, gpu_bitonic<T> base)
+      : local_bitonic<T, t_name>{segment_size, base}, m_kernel_merge{m_ctx, [](auto index_type) {
+          return kernel_merge::source(t_name::name_str, index_type);
+        }} {
+    if (this->m_wide_index) m_kernel_merge.force_wide_index();
+  }
+
+  sorted_device_array(const unsigned segment_size, bool verbose)
+      : sorted_device_array{segment_size, gpu_bitonic<T>{verbose}} {}
+
+  size_type size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  void clear() { m_size = 0; }
+
+  // Device buffer with size() sorted elements. It is replaced on every insertion.
+  cl::Buffer buffer() const { return m_data; }
+
+  void insert(std::span<const T> batch, clutils::profiling_info *time = nullptr) {
+    const size_type batch_size = batch.size();
+    if (batch_size == 0) return;
+
+    const size_type padded_size = std::bit_ceil(batch_size), new_size = m_size + batch_size;
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+
+    this->check_allocation_size(padded_size * sizeof(T));
+    cl::Buffer sorted_batch = {m_ctx, CL_MEM_READ_WRITE, padded_size * sizeof(T)};
+    cl::copy(m_queue, batch.begin(), batch.end(), sorted_batch);
+
+    // Padding ends up after all the elements of the batch and is simply not merged
+    if (padded_size != batch_size) {
+      m_queue.enqueueFillBuffer(sorted_batch, std::numeric_limits<T>::max(), batch_size * sizeof(T),
+                                (padded_size - batch_size) * sizeof(T));
+    }
+
+    reset_chain();
+    enqueue_sort(sorted_batch, padded_size, std::countr_zero(padded_size));
+
+    // Both buffers are allocated here in turn, since they are swapped after every insertion. They grow from the live
+    // size rather than from each other's capacity, so neither holds more than twice the elements at its allocation.
+    if (m_scratch_capacity < new_size) {
+      m_scratch_capacity = std::max(new_size, 2 * m_size);
+      this->check_allocation_size(m_scratch_capacity * sizeof(T));
+      m_scratch = cl::Buffer{m_ctx, CL_MEM_READ_WRITE, m_scratch_capacity * sizeof(T)};
+    }
+
+    if (empty()) {
+      cl::Event event;
+      m_queue.enqueueCopyBuffer(sorted_batch, m_scratch, 0, 0, batch_size * sizeof(T), nullptr, &event);
+      submit(event);
+    } else {
+      const auto args = cl::EnqueueArgs{m_queue, new_size};
+      submit(m_kernel_merge.run(new_size, args, m_data, m_size, sorted_batch, batch_size, m_scratch));
     }
+
+    std::swap(m_data, m_scratch);
+    std::swap(m_data_capacity, m_scratch_capacity);
+    m_size = new_size;
+
+    m_last_event.wait();
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+    fill_profiling_info(time, wall_start, wall_end);
+  }
+
+  void copy_to(std::span<T> container) const {
+    if (container.size() != m_size) throw std::invalid_argument{"Mismatched container size"};
+    if (empty()) return;
+    cl::copy(m_queue, m_data, container.begin(), container.end());
+  }
+
+  std::vector<T> to_vector() const {
+    std::vector<T> result;
+    result.resize(m_size);
+    copy_to(result);
+    return result;
+  }
+};
+
+// Checks a sequence in device memory without downloading it: every work-group reports whether its part is sorted and a
+// partial multiset hash, which can be compared to clutils::multiset_hash of the input.
+template <typename T, typename t_name> class sort_validator : public gpu_bitonic<T> {
+  using kernel = sort_validate_kernel;
+
+private:
+  using gpu_bitonic<T>::m_ctx;
+  using gpu_bitonic<T>::m_queue;
+  using gpu_bitonic<T>::m_device;
+
+  using typename gpu_bitonic<T>::size_type;
+
+  static constexpr size_type max_work_group_size = 256;
+  static constexpr size_type groups_per_compute_unit = 4;
+
+  size_type m_work_group_size, m_max_groups;
+  indexed_kernel<kernel> m_kernel;
+
+public:
+  sort_validator(gpu_bitonic<T> base)
+      : gpu_bitonic<T>{base},
+        m_work_group_size{std::bit_floor(std::min<size_type>(
+            max_work_group_size, base.template get_device_info<CL_DEVICE_MAX_WORK_GROUP_SIZE>()))},
+        m_max_groups{groups_per_compute_unit * base.template get_device_info<CL_DEVICE_MAX_COMPUTE_UNITS>()},
+        m_kernel{m_ctx, [wg_size = m_work_group_size](auto index_type) {
+                   return kernel::source(t_name::name_str, wg_size, index_type);
+                 }} {
+    if (this->m_wide_index) m_kernel.force_wide_index();
+  }
+
+  sort_validator(bool verbose) : sort_validator{gpu_bitonic<T>{verbose}} {}
+
+  clutils::sort_check_result check(cl::Buffer buf, const size_type size) {
+    if (size == 0) return {true, 0};
+
+    const size_type groups = std::min(m_max_groups, (size + m_work_group_size - 1) / m_work_group_size);
+
+    std::vector<cl_ulong> partial_hashes;
+    partial_hashes.resize(groups);
+    cl::Buffer hashes_buf = {m_ctx, CL_MEM_WRITE_ONLY, clutils::sizeof_container(partial_hashes)};
+
+    cl_int unsorted = 0;
+    cl::Buffer unsorted_buf = {m_ctx, CL_MEM_READ_WRITE, sizeof(cl_int)};
+    m_queue.enqueueFillBuffer(unsorted_buf, unsorted, 0, sizeof(cl_int));
+
+    const auto args = cl::EnqueueArgs{m_queue, groups * m_work_group_size, m_work_group_size};
+    m_kernel.get(size)(args, buf, size, hashes_buf, unsorted_buf);
+
+    cl::copy(m_queue, hashes_buf, partial_hashes.begin(), partial_hashes.end());
+    m_queue.enqueueReadBuffer(unsorted_buf, true, 0, sizeof(cl_int), &unsorted);
+
+    const auto hash = std::accumulate(partial_hashes.begin(), partial_hashes.end(), std::uint64_t{0});
+    return {unsorted == 0, hash};
+  }
+
+  clutils::sort_check_result check(std::span<const T> container) {
+    if (container.empty()) return {true, 0};
+    this->check_allocation_size(clutils::sizeof_container(container));
+    cl::Buffer buf = {m_ctx, CL_MEM_READ_ONLY, clutils::sizeof_container(container)};
+    cl::copy(m_queue, container.begin(), container.end(), buf);
+    return check(buf, container.size());
+  }
+};
+
+// Generates the Philox stream of clutils::counter_based_generator directly in device memory, so benchmark inputs don't
+// have to be uploaded. The host generator with the same seed reproduces the data exactly.
+template <typename T, typename t_name> class device_random_generator : public gpu_bitonic<T> {
+  using kernel = philox_fill_kernel;
+
+private:
+  using gpu_bitonic<T>::m_ctx;
+  using gpu_bitonic<T>::m_queue;
+
+  using typename gpu_bitonic<T>::size_type;
+
+  indexed_kernel<kernel> m_kernel;
+
+public:
+  device_random_generator(gpu_bitonic<T> base)
+      : gpu_bitonic<T>{base}, m_kernel{m_ctx, [](auto index_type) {
+          return kernel::source(t_name::name_str, clutils::philox_float_bits<T>(), index_type);
+        }} {
+    if (this->m_wide_index) m_kernel.force_wide_index();
+  }
+
+  device_random_generator(bool verbose) : device_random_generator{gpu_bitonic<T>{verbose}} {}
+
+  // Fill the first size elements of buf with elements [offset, offset + size) of the stream
+  void fill(cl::Buffer buf, const size_type size, const clutils::counter_based_generator<T> &gen,
+            const std::uint64_t offset = 0) {
+    if (size == 0) return;
+    const auto args = cl::EnqueueArgs{m_queue, size};
+    m_kernel.get(size)(args, buf, offset, gen.seed(), clutils::encode_bound(gen.lower()),
+                       clutils::encode_bound(gen.upper()))
+        .wait();
+  }
+
+  cl::Buffer generate(const size_type size, const clutils::counter_based_generator<T> &gen,
+                      const std::uint64_t offset = 0) {
+    this->check_allocation_size(size * sizeof(T));
+    cl::Buffer buf = {m_ctx, CL_MEM_READ_WRITE, size * sizeof(T)};
+    fill(buf, size, gen, offset);
+    return buf;
   }
 };
 
-} // namespace bitonic
\ No newline at end of file
+} // namespace bitonic
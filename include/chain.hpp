@@ -0,0 +1,309 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "matmult.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace matmult {
+
+// Optimal order of a matrix chain product found by the classic dynamic program. Matrix i of the chain is
+// dims[i] x dims[i + 1], and the cheapest way to multiply matrices i..j is split after some k into (i..k) and
+// (k + 1..j), which is found in O(n^3) from the costs of all shorter subchains.
+class chain_order {
+public:
+  using size_type = std::size_t;
+
+private:
+  std::vector<size_type> m_dims;
+  std::vector<size_type> m_split; // n x n, split of the subchain i..j at [i * n + j]
+  double m_cost = 0;
+
+public:
+  explicit chain_order(std::vector<size_type> dims) : m_dims{std::move(dims)} {
+    if (m_dims.size() < 2) throw std::invalid_argument{"Chain should have at least one matrix"};
+    if (std::find(m_dims.begin(), m_dims.end(), 0) != m_dims.end())
+      throw std::invalid_argument{"Matrices of a chain can't be empty"};
+
+    const auto n = size();
+    m_split.assign(n * n, 0);
+    // Number of multiply-adds of the cheapest order of every subchain
+    std::vector<double> cost(n * n, 0.0);
+
+    for (size_type length = 2; length <= n; ++length) {
+      for (size_type i = 0; i + length <= n; ++i) {
+        const auto j = i + length - 1;
+        cost[i * n + j] = std::numeric_limits<double>::infinity();
+        for (size_type k = i; k < j; ++k) {
+          const double candidate = cost[i * n + k] + cost[(k + 1) * n + j] +
+                                   static_cast<double>(m_dims[i]) * m_dims[k + 1] * m_dims[j + 1];
+          if (candidate >= cost[i * n + j]) continue;
+          cost[i * n + j] = candidate;
+          m_split[i * n + j] = k;
+        }
+      }
+    }
+
+    m_cost = cost[n - 1];
+  }
+
+  size_type size() const { return m_dims.size() - 1; }
+  const std::vector<size_type> &dims() const { return m_dims; }
+
+  // Last matrix of the left part of subchain i..j in the optimal order
+  size_type split(size_type i, size_type j) const { return m_split[i * size() + j]; }
+
+  // Multiply-adds of the optimal order
+  double cost() const { return m_cost; }
+
+  // Multiply-adds of multiplying from left to right
+  double naive_cost() const {
+    double res = 0;
+    for (size_type j = 1; j < size(); ++j) {
+      res += static_cast<double>(m_dims[0]) * m_dims[j] * m_dims[j + 1];
+    }
+    return res;
+  }
+
+  // Parenthesization such as ((A0 A1) A2)
+  std::string to_string() const { return to_string(0, size() - 1); }
+
+private:
+  std::string to_string(size_type i, size_type j) const {
+    if (i == j) return "A" + std::to_string(i);
+    const auto k = split(i, j);
+    return "(" + to_string(i, k) + " " + to_string(k + 1, j) + ")";
+  }
+};
+
+// Products of matrix chains and powers of a matrix on the device, multiplied by any GPU engine. Intermediates never
+// leave the device: a chain is multiplied in the optimal order, and before anything runs a lifetime plan assigns every
+// intermediate to a scratch buffer that is free at that point, so buffers are reused once the products that read them
+// are done. Only as many scratch buffers are allocated as there are intermediates alive at the same time.
+template <typename T> class chain_matmult {
+public:
+  using matrix_type = host_matrix<T>;
+  using device_matrix_type = device_matrix<T>;
+  using size_type = std::size_t;
+
+  static constexpr size_type c_no_slot = std::numeric_limits<size_type>::max();
+
+  // Product of matrices first..last split after matrix split. Operands that are products themselves are read from
+  // their scratch slots, the result is written to slot, or to the output for the last step.
+  struct step {
+    size_type first, split, last;
+    size_type left_slot, right_slot, slot;
+  };
+
+  struct plan {
+    std::vector<step> steps;
+    std::vector<size_type> capacities; // Elements of every scratch buffer
+  };
+
+private:
+  gpu_matmult<T> &m_engine;
+
+  // Steps of subchain i..j in post order, so that operands are computed before the products that read them. Returns
+  // the slot of the result.
+  static size_type plan_subchain(const chain_order &order, size_type i, size_type j, plan &res,
+                                 std::vector<char> &busy) {
+    if (i == j) return c_no_slot;
+
+    const auto k = order.split(i, j);
+    const auto left = plan_subchain(order, i, k, res, busy);
+    const auto right = plan_subchain(order, k + 1, j, res, busy);
+
+    // The result can't share a buffer with the operands, so they are released only after a slot is taken. The
+    // smallest free slot that is large enough is reused, otherwise the largest free one grows.
+    size_type slot = c_no_slot;
+    if (i != 0 || j + 1 != order.size()) {
+      const auto elements = order.dims()[i] * order.dims()[j + 1];
+      for (size_type s = 0; s < busy.size(); ++s) {
+        if (busy[s]) continue;
+        if (slot == c_no_slot) {
+          slot = s;
+          continue;
+        }
+
+        const bool fits = res.capacities[s] >= elements, best_fits = res.capacities[slot] >= elements;
+        if ((fits && (!best_fits || res.capacities[s] < res.capacities[slot])) ||
+            (!fits && !best_fits && res.capacities[s] > res.capacities[slot]))
+          slot = s;
+      }
+
+      if (slot == c_no_slot) {
+        slot = busy.size();
+        busy.push_back(false);
+        res.capacities.push_back(0);
+      }
+
+      busy[slot] = true;
+      res.capacities[slot] = std::max(res.capacities[slot], elements);
+    }
+
+    res.steps.push_back({i, k, j, left, right, slot});
+    if (left != c_no_slot) busy[left] = false;
+    if (right != c_no_slot) busy[right] = false;
+    return slot;
+  }
+
+  static std::chrono::milliseconds to_ms(std::chrono::nanoseconds time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time);
+  }
+
+public:
+  // Epilogues would be applied to every intermediate, so the engine shouldn't have one
+  explicit chain_matmult(gpu_matmult<T> &engine) : m_engine{engine} {
+    if (!engine.get_epilogue().empty()) throw std::invalid_argument{"Chain products can't apply epilogues"};
+  }
+
+  static plan make_plan(const chain_order &order) {
+    plan res;
+    std::vector<char> busy;
+    plan_subchain(order, 0, order.size() - 1, res, busy);
+    return res;
+  }
+
+  // Product of a chain of device matrices. Pure time is the sum of the device times of the products.
+  device_matrix_type multiply_chain(const std::vector<device_matrix_type> &chain, profiling_info *time = nullptr) {
+    if (chain.empty()) throw std::invalid_argument{"Chain should have at least one matrix"};
+
+    std::vector<size_type> dims = {chain.front().rows()};
+    for (const auto &mat : chain) {
+      if (mat.rows() != dims.back()) throw std::invalid_argument{"Mismatched matrix sizes in the chain"};
+      dims.push_back(mat.cols());
+    }
+
+    const chain_order order{dims};
+    const auto chain_plan = make_plan(order);
+
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    std::vector<cl::Buffer> scratch;
+    for (const auto capacity : chain_plan.capacities) {
+      scratch.push_back(m_engine.allocate(capacity, 1).buffer());
+    }
+
+    const auto operand = [&](size_type first, size_type last, size_type slot) {
+      if (slot == c_no_slot) return chain[first];
+      return device_matrix_type{scratch[slot], dims[first], dims[last + 1]};
+    };
+
+    // A single matrix is its own product
+    device_matrix_type res = (chain.size() == 1 ? chain.front() : m_engine.allocate(dims.front(), dims.back()));
+    std::chrono::nanoseconds pure{0};
+
+    for (const auto &s : chain_plan.steps) {
+      auto out = (s.slot == c_no_slot ? res : device_matrix_type{scratch[s.slot], dims[s.first], dims[s.last + 1]});
+      pure += m_engine.device_time(operand(s.first, s.split, s.left_slot), operand(s.split + 1, s.last, s.right_slot),
+                                   out);
+    }
+
+    auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (time) *time = {to_ms(pure), to_ms(wall_end - wall_start)};
+    return res;
+  }
+
+  matrix_type multiply_chain(const std::vector<matrix_type> &chain, profiling_info *time = nullptr) {
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    std::vector<device_matrix_type> device_chain;
+    device_chain.reserve(chain.size());
+    for (const auto &mat : chain) {
+      device_chain.push_back(m_engine.upload(mat));
+    }
+
+    profiling_info device_info;
+    auto res = m_engine.download(multiply_chain(device_chain, &device_info));
+
+    auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (time) *time = {device_info.pure, to_ms(wall_end - wall_start)};
+    return res;
+  }
+
+  // A^k by repeated squaring in floor(log2 k) + popcount(k) - 1 products. Three scratch buffers are enough: the
+  // accumulated product, the current square of A and a free one for the next result, which is never an operand. A
+  // itself is never written to, and A^1 is A.
+  device_matrix_type power(const device_matrix_type &mat, unsigned long long k, profiling_info *time = nullptr) {
+    if (mat.rows() != mat.cols()) throw std::invalid_argument{"Only square matrices can be raised to a power"};
+    if (k == 0) {
+      matrix_type identity = {mat.rows(), mat.cols()};
+      for (size_type i = 0; i < mat.rows(); ++i) {
+        identity.data()[i * mat.cols() + i] = T{1};
+      }
+      return m_engine.upload(identity);
+    }
+
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    // A and three scratch buffers. The square starts as A itself and moves to scratch buffers, which are allocated on
+    // first use.
+    std::array<device_matrix_type, 4> buffers = {mat};
+    size_type square = 0, acc = c_no_slot;
+    const auto free_buffer = [&]() {
+      for (size_type b = 1; b < buffers.size(); ++b) {
+        if (b == square || b == acc) continue;
+        if (!buffers[b].size()) buffers[b] = m_engine.allocate(mat.rows(), mat.cols());
+        return b;
+      }
+      throw std::logic_error{"No free buffer for matrix power"};
+    };
+
+    std::chrono::nanoseconds pure{0};
+    for (auto bits = k;; bits >>= 1) {
+      if (bits & 1) {
+        // The first factor is the current square, which keeps its buffer while the square moves on
+        if (acc == c_no_slot) {
+          acc = square;
+        } else {
+          const auto out = free_buffer();
+          pure += m_engine.device_time(buffers[acc], buffers[square], buffers[out]);
+          acc = out;
+        }
+      }
+
+      if (bits == 1) break;
+      const auto out = free_buffer();
+      pure += m_engine.device_time(buffers[square], buffers[square], buffers[out]);
+      square = out;
+    }
+
+    auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (time) *time = {to_ms(pure), to_ms(wall_end - wall_start)};
+    return buffers[acc];
+  }
+
+  matrix_type power(const matrix_type &mat, unsigned long long k, profiling_info *time = nullptr) {
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    profiling_info device_info;
+    auto res = m_engine.download(power(m_engine.upload(mat), k, &device_info));
+
+    auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (time) *time = {device_info.pure, to_ms(wall_end - wall_start)};
+    return res;
+  }
+};
+
+} // namespace matmult
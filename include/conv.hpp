@@ -0,0 +1,193 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "matmult.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <stdexcept>
+
+#include "kernelhpp/conv_im2col_kernel.hpp"
+
+namespace matmult {
+
+// 2D convolution of a batch of NCHW images with K filters of C x R x S elements. As in most frameworks filters aren't
+// flipped, so this is cross-correlation. Images of a batch are rows of an input matrix [batch x C * H * W], filters are
+// rows of a matrix [K x C * R * S] and the output is [batch x K * P * Q], which is NKPQ.
+struct conv_shape {
+  std::size_t batch, channels, height, width;
+  std::size_t filters, filter_height, filter_width;
+  std::size_t stride = 1, padding = 0;
+
+  std::size_t out_height() const { return (height + 2 * padding - filter_height) / stride + 1; }
+  std::size_t out_width() const { return (width + 2 * padding - filter_width) / stride + 1; }
+  std::size_t out_pixels() const { return out_height() * out_width(); }
+
+  // Length of a filter, which is the depth of the equivalent matrix product
+  std::size_t depth() const { return channels * filter_height * filter_width; }
+
+  std::size_t image_size() const { return channels * height * width; }
+  std::size_t output_size() const { return filters * out_pixels(); }
+
+  // Each output element takes depth multiplications and additions
+  double flop() const { return 2.0 * batch * filters * out_pixels() * depth(); }
+
+  void validate() const {
+    if (!batch || !channels || !height || !width || !filters || !filter_height || !filter_width)
+      throw std::invalid_argument{"Convolution sizes can't be zero"};
+    if (!stride) throw std::invalid_argument{"Stride can't be zero"};
+    if (filter_height > height + 2 * padding || filter_width > width + 2 * padding)
+      throw std::invalid_argument{"Filter doesn't fit into the padded image"};
+  }
+
+  void check(const auto &input, const auto &filters_mat) const {
+    validate();
+    if (input.rows() != batch || input.cols() != image_size())
+      throw std::invalid_argument{"Input should be a batch x C * H * W matrix"};
+    if (filters_mat.rows() != filters || filters_mat.cols() != depth())
+      throw std::invalid_argument{"Filters should be a K x C * R * S matrix"};
+  }
+};
+
+// Direct convolution on the host to compare with, pairs of an image and a filter are split between threads
+template <typename T>
+host_matrix<T> cpu_conv2d(const conv_shape &shape, const host_matrix<T> &input, const host_matrix<T> &filters,
+                          unsigned threads = clutils::default_thread_count()) {
+  shape.check(input, filters);
+  host_matrix<T> output = {shape.batch, shape.output_size()};
+
+  const std::ptrdiff_t height = shape.height, width = shape.width, padding = shape.padding;
+  const auto out_height = shape.out_height(), out_width = shape.out_width();
+
+  clutils::parallel_chunks(
+      shape.batch * shape.filters,
+      [&](std::size_t begin, std::size_t end) {
+        for (std::size_t idx = begin; idx < end; ++idx) {
+          const auto n = idx / shape.filters, k = idx % shape.filters;
+          const T *image = input.data() + n * shape.image_size();
+          const T *filter = filters.data() + k * shape.depth();
+          T *out = output.data() + n * shape.output_size() + k * shape.out_pixels();
+
+          for (std::size_t p = 0; p < out_height; ++p) {
+            for (std::size_t q = 0; q < out_width; ++q) {
+              T sum = 0;
+              for (std::size_t c = 0; c < shape.channels; ++c) {
+                const T *channel = image + c * shape.height * shape.width;
+                for (std::size_t r = 0; r < shape.filter_height; ++r) {
+                  const auto y = static_cast<std::ptrdiff_t>(p * shape.stride + r) - padding;
+                  if (y < 0 || y >= height) continue;
+                  const T *taps = filter + (c * shape.filter_height + r) * shape.filter_width;
+                  for (std::size_t s = 0; s < shape.filter_width; ++s) {
+                    const auto x = static_cast<std::ptrdiff_t>(q * shape.stride + s) - padding;
+                    if (x < 0 || x >= width) continue;
+                    sum += channel[y * width + x] * taps[s];
+                  }
+                }
+              }
+              out[p * out_width + q] = sum;
+            }
+          }
+        }
+      },
+      threads);
+
+  return output;
+}
+
+// Convolution as im2col followed by GEMM with the tiledarb kernel. The batch is expanded into a depth x batch * P * Q
+// matrix on the device, then the filters are multiplied by the columns of each image straight into its K x P * Q block
+// of the output through views, so nothing is copied or rearranged. The expanded matrix takes about R * S / stride^2
+// times the memory of the input.
+template <typename T, typename t_name> class conv2d_matmult : public tiled_arbitrary_matmult<T, t_name> {
+  using kernel = conv_im2col_kernel;
+
+public:
+  using typename gpu_matmult<T>::matrix_type;
+  using typename gpu_matmult<T>::device_matrix_type;
+
+private:
+  using gpu_matmult<T>::m_ctx;
+  using gpu_matmult<T>::m_queue;
+  using gpu_matmult<T>::get_profiling_info;
+
+  cl::Program m_program;
+  kernel::functor_type m_functor;
+
+public:
+  conv2d_matmult(unsigned tile_size, gpu_matmult<T> base, bool prefetch = false)
+      : tiled_arbitrary_matmult<T, t_name>{tile_size, base, prefetch},
+        m_program{m_ctx, kernel::source(t_name::name_str), true}, m_functor{m_program, kernel::entry()} {
+    // Bias of the epilogue is indexed by column, which is a pixel here rather than a filter
+    this->reject_epilogue("Convolution");
+  }
+
+  conv2d_matmult(unsigned tile_size, bool prefetch = false) : conv2d_matmult{tile_size, gpu_matmult<T>{}, prefetch} {}
+
+  // Convolution of device matrices, the output should be batch x K * P * Q
+  void convolve(const conv_shape &shape, const device_matrix_type &input, const device_matrix_type &filters,
+                device_matrix_type &output, profiling_info *time = nullptr) {
+    shape.check(input, filters);
+    if (output.rows() != shape.batch || output.cols() != shape.output_size())
+      throw std::invalid_argument{"Output should be a batch x K * P * Q matrix"};
+
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    const auto pixels = shape.out_pixels(), columns = shape.batch * pixels;
+    device_matrix_type expanded = {m_ctx, shape.depth(), columns};
+
+    cl::EnqueueArgs args = {m_queue, {columns, shape.depth()}};
+    auto first = m_functor(args, input.buffer(), expanded.buffer(), shape.batch, shape.channels, shape.height,
+                           shape.width, shape.filter_height, shape.filter_width, shape.out_height(), shape.out_width(),
+                           shape.stride, shape.padding);
+
+    // One product per image keeps the output in NKPQ. They follow im2col on the in-order queue without waiting.
+    cl::Event last;
+    for (std::size_t n = 0; n < shape.batch; ++n) {
+      last = this->enqueue_gemm({.alpha = 1,
+                                 .a = filters.view(),
+                                 .b = {expanded.buffer(), shape.depth(), pixels, columns, n * pixels},
+                                 .beta = 0,
+                                 .c = {output.buffer(), shape.filters, pixels, pixels, n * shape.output_size()}});
+    }
+    last.wait();
+
+    auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (time) *time = get_profiling_info(first, last, wall_start, wall_end);
+  }
+
+  device_matrix_type convolve(const conv_shape &shape, const device_matrix_type &input,
+                              const device_matrix_type &filters, profiling_info *time = nullptr) {
+    device_matrix_type output = {m_ctx, shape.batch, shape.output_size()};
+    convolve(shape, input, filters, output, time);
+    return output;
+  }
+
+  // Wall time includes the transfers, pure time only im2col and the products
+  matrix_type convolve(const conv_shape &shape, const matrix_type &input, const matrix_type &filters,
+                       profiling_info *time = nullptr) {
+    shape.check(input, filters);
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    auto bufi = this->upload(input), buff = this->upload(filters);
+    profiling_info device_info;
+    auto bufo = convolve(shape, bufi, buff, &device_info);
+    auto output = this->download(bufo);
+
+    auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (time) *time = {device_info.pure, std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start)};
+    return output;
+  }
+};
+
+} // namespace matmult
@@ -0,0 +1,1804 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+
+#include "opencl_include.hpp"
+#include "parallel.hpp"
+#include "reduced_precision.hpp"
+#include "selector.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "linmath/contiguous_matrix.hpp"
+
+#include "kernelhpp/matmult_gemv_kernel.hpp"
+#include "kernelhpp/matmult_mixed_kernel.hpp"
+#include "kernelhpp/matmult_naive_kernel.hpp"
+#include "kernelhpp/matmult_regblocked_kernel.hpp"
+#include "kernelhpp/matmult_strassen_combine_kernel.hpp"
+#include "kernelhpp/matmult_strassen_operands_kernel.hpp"
+#include "kernelhpp/matmult_syrk_kernel.hpp"
+#include "kernelhpp/matmult_tiled_arb_kernel.hpp"
+#include "kernelhpp/matmult_tiled_kernel.hpp"
+#include "kernelhpp/matmult_transpose_kernel.hpp"
+#include "kernelhpp/matmult_trmm_kernel.hpp"
+
+namespace matmult {
+
+namespace linmath = throttle::linmath;
+using clutils::profiling_info;
+
+template <typename T> using host_matrix = linmath::contiguous_matrix<T>;
+
+struct matrix_sizes {
+  std::size_t ax, ay, by;
+};
+
+// Work-group of the tiled kernels is m x n work-items that compute an m x n block of C, multiplying m x k tiles of A by
+// k x n tiles of B
+struct tile_shape {
+  unsigned m, n, k;
+
+  static tile_shape square(unsigned size) { return {size, size, size}; }
+  bool is_square() const { return m == n && n == k; }
+};
+
+// Distances in elements between consecutive matrices of a strided batch
+struct batch_strides {
+  cl_ulong a, b, c;
+};
+
+// Element offsets of A, B and C of one product in an indirect batch. Layout matches what matmult_tiled_arb.cl reads.
+struct batch_offsets {
+  cl_ulong a, b, c;
+};
+
+static_assert(sizeof(batch_offsets) == 3 * sizeof(cl_ulong));
+
+// Busy time of the transfer and compute queues of a streamed product and the time during which both were busy
+struct streaming_info {
+  std::chrono::milliseconds transfer, compute, overlap;
+};
+
+// Block of a row-major matrix in a device buffer: rows x cols elements starting at offset, with ld elements between
+// the beginnings of consecutive rows. Offset and ld are counted in elements.
+template <typename T> struct matrix_view {
+  cl::Buffer buffer;
+  std::size_t rows, cols, ld, offset = 0;
+};
+
+// C = alpha * op(A) * op(B) + beta * C, where op transposes its argument when trans_a or trans_b is set. C isn't read
+// when beta is zero.
+template <typename T> struct gemm_arguments {
+  T alpha = 1;
+  matrix_view<T> a;
+  bool trans_a = false;
+  matrix_view<T> b;
+  bool trans_b = false;
+  T beta = 0;
+  matrix_view<T> c;
+};
+
+enum class activation : unsigned { none = 0, relu = 1, clamp = 2, sigmoid = 3, tanh = 4 };
+
+// Elementwise operations fused into the store of C: the result is scaled, the bias of its column is added, the
+// activation is applied, and finally the value is rounded to a narrower integer type with saturation. Values are
+// compiled into the kernels as the EPILOGUE macro, which works on `result` and `col` and reads the `bias` argument.
+template <typename T> struct epilogue {
+  T scale = 1;
+  bool bias = false;
+  activation act = activation::none;
+  T lower = 0, upper = 0; // Bounds of activation::clamp
+  std::string convert;    // OpenCL integer type such as "char", empty for no conversion
+
+  bool empty() const { return scale == T{1} && !bias && act == activation::none && convert.empty(); }
+
+  void validate() const {
+    static const std::set<std::string> integer_types = {"char", "uchar", "short", "ushort", "int", "uint"};
+    if (!convert.empty() && !integer_types.contains(convert))
+      throw std::invalid_argument{"Epilogue can only convert to char, uchar, short, ushort, int or uint"};
+    if (act == activation::clamp && lower > upper) throw std::invalid_argument{"Clamp bounds are in the wrong order"};
+    if (std::is_integral_v<T> && (act == activation::sigmoid || act == activation::tanh))
+      throw std::invalid_argument{"Sigmoid and tanh need a floating point type"};
+  }
+
+  // Exact literal of a value: floating point values are printed in hex, so no rounding happens on the way
+  static std::string literal(T value) {
+    std::ostringstream ss;
+    if constexpr (std::is_floating_point_v<T>) ss << std::hexfloat << value << (std::is_same_v<T, float> ? "f" : "");
+    else ss << +value;
+    return "((TYPE)" + ss.str() + ")";
+  }
+
+  std::string source() const {
+    validate();
+    std::string code;
+    if (scale != T{1}) code += "result *= " + literal(scale) + ";";
+    if (bias) code += "result += bias[col];";
+
+    switch (act) {
+    case activation::none: break;
+    case activation::relu: code += "result = max(result, (TYPE)0);"; break;
+    case activation::clamp: code += "result = clamp(result, " + literal(lower) + ", " + literal(upper) + ");"; break;
+    case activation::sigmoid: code += "result = 1 / (1 + exp(-result));"; break;
+    case activation::tanh: code += "result = tanh(result);"; break;
+    }
+
+    if (!convert.empty()) code += "result = (TYPE)convert_" + convert + "_sat_rte(result);";
+    return code;
+  }
+
+  // Same operations on the host, to check results against a reference product
+  T apply(T result, T bias_value) const {
+    result *= scale;
+    if (bias) result += bias_value;
+
+    switch (act) {
+    case activation::none: break;
+    case activation::relu: result = std::max(result, T{0}); break;
+    case activation::clamp: result = std::clamp(result, lower, upper); break;
+    case activation::sigmoid: result = 1 / (1 + std::exp(-result)); break;
+    case activation::tanh: result = std::tanh(result); break;
+    }
+
+    if (!convert.empty()) result = saturate(result);
+    return result;
+  }
+
+private:
+  T saturate(T value) const {
+    const auto round_to = [value](auto limits) {
+      using narrow = typename decltype(limits)::type;
+      const auto rounded = [value]() -> long double {
+        if constexpr (std::is_floating_point_v<T>) return std::nearbyint(static_cast<long double>(value));
+        else return value;
+      }();
+      return static_cast<T>(std::clamp<long double>(rounded, std::numeric_limits<narrow>::lowest(),
+                                                    std::numeric_limits<narrow>::max()));
+    };
+
+    if (convert == "char") return round_to(std::type_identity<cl_char>{});
+    if (convert == "uchar") return round_to(std::type_identity<cl_uchar>{});
+    if (convert == "short") return round_to(std::type_identity<cl_short>{});
+    if (convert == "ushort") return round_to(std::type_identity<cl_ushort>{});
+    if (convert == "int") return round_to(std::type_identity<cl_int>{});
+    return round_to(std::type_identity<cl_uint>{});
+  }
+};
+
+// Matrix stored in a device buffer. Data is transferred to and from host matrices only on explicit request through
+// gpu_matmult::upload and gpu_matmult::download, so results can be passed to the next product without leaving the
+// device. The buffer is shared between copies, same as cl::Buffer itself.
+template <typename T> class device_matrix {
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+
+private:
+  cl::Buffer m_buf;
+  size_type m_rows = 0, m_cols = 0;
+
+public:
+  device_matrix() = default;
+
+  device_matrix(cl::Context ctx, size_type rows, size_type cols) : m_rows{rows}, m_cols{cols} {
+    if (rows == 0 || cols == 0) throw std::invalid_argument{"Device matrix can't be empty"};
+    m_buf = cl::Buffer{ctx, CL_MEM_READ_WRITE, bin_size()};
+  }
+
+  // Matrix in the beginning of an existing buffer, so that scratch buffers can hold matrices of different shapes
+  device_matrix(cl::Buffer buf, size_type rows, size_type cols) : m_buf{buf}, m_rows{rows}, m_cols{cols} {
+    if (rows == 0 || cols == 0) throw std::invalid_argument{"Device matrix can't be empty"};
+    if (buf.getInfo<CL_MEM_SIZE>() < bin_size()) throw std::invalid_argument{"Buffer is too small for the matrix"};
+  }
+
+  size_type rows() const { return m_rows; }
+  size_type cols() const { return m_cols; }
+  size_type size() const { return m_rows * m_cols; }
+  size_type bin_size() const { return size() * sizeof(T); }
+
+  cl::Buffer buffer() const { return m_buf; }
+
+  matrix_view<T> view() const { return {m_buf, m_rows, m_cols, m_cols, 0}; }
+
+  // rows x cols block with the upper left corner at (row, col)
+  matrix_view<T> block(size_type row, size_type col, size_type rows, size_type cols) const {
+    if (row + rows > m_rows || col + cols > m_cols) throw std::out_of_range{"Block is out of the matrix bounds"};
+    return {m_buf, rows, cols, m_cols, row * m_cols + col};
+  }
+};
+
+template <typename T> class i_matmult {
+public:
+  using matrix_type = host_matrix<T>;
+
+  virtual matrix_type operator()(const matrix_type &, const matrix_type &, profiling_info *) = 0;
+
+  matrix_type multiply(const matrix_type &mata, const matrix_type &matb, profiling_info *time = nullptr) {
+    return operator()(mata, matb, time);
+  }
+
+  virtual ~i_matmult() {}
+};
+
+// Blocked GEMM on the host in the spirit of GotoBLAS. A kc x nc panel of B and an mc x kc block of A are packed into
+// slivers that the micro-kernel reads contiguously, while a c_mr x c_nr block of C stays in vector registers. Rows of C
+// are split between threads, each of which packs its own blocks of A.
+template <typename T> class cpu_matmult : public i_matmult<T> {
+  static_assert(std::is_arithmetic_v<T>, "CPU engine only multiplies arithmetic types");
+
+public:
+  using typename i_matmult<T>::matrix_type;
+  using size_type = std::size_t;
+
+private:
+#if defined(__AVX512F__)
+  static constexpr size_type c_vector_bytes = 64;
+#elif defined(__AVX__)
+  static constexpr size_type c_vector_bytes = 32;
+#else
+  static constexpr size_type c_vector_bytes = 16;
+#endif
+
+#if defined(__GNUC__)
+  typedef T vector_type __attribute__((vector_size(c_vector_bytes)));
+#endif
+
+  static constexpr size_type c_lanes = c_vector_bytes / sizeof(T);
+  static constexpr size_type c_vectors = 2;
+  static constexpr size_type c_mr = 6, c_nr = c_vectors * c_lanes;
+
+  // A sliver of B is kept in L1 and a block of A in L2 while the micro-kernel walks over them
+  static constexpr size_type c_kc = 256, c_mc = 16 * c_mr, c_nc = 4096;
+
+  unsigned m_threads;
+
+  static size_type round_up(size_type sz, size_type multiple) { return (sz + multiple - 1) / multiple * multiple; }
+
+  // Slivers of c_mr rows stored column by column, padded with zeros
+  static void pack_a(const T *a, size_type lda, size_type rows, size_type kc, T *dst) {
+    for (size_type ir = 0; ir < rows; ir += c_mr) {
+      for (size_type p = 0; p < kc; ++p) {
+        for (size_type i = 0; i < c_mr; ++i) {
+          *dst++ = (ir + i < rows ? a[(ir + i) * lda + p] : T{});
+        }
+      }
+    }
+  }
+
+  // One sliver of c_nr columns stored row by row, padded with zeros
+  static void pack_b(const T *b, size_type ldb, size_type kc, size_type cols, T *dst) {
+    for (size_type p = 0; p < kc; ++p) {
+      for (size_type j = 0; j < c_nr; ++j) {
+        *dst++ = (j < cols ? b[p * ldb + j] : T{});
+      }
+    }
+  }
+
+  // rows x cols block of C is overwritten with or incremented by the product of two slivers
+  static void micro_kernel(size_type kc, const T *pa, const T *pb, T *c, size_type ldc, size_type rows, size_type cols,
+                           bool overwrite) {
+#if defined(__GNUC__)
+    vector_type acc[c_mr][c_vectors] = {};
+    for (size_type p = 0; p < kc; ++p, pa += c_mr, pb += c_nr) {
+      vector_type b[c_vectors];
+      std::memcpy(b, pb, sizeof(b));
+      for (size_type i = 0; i < c_mr; ++i) {
+        for (size_type j = 0; j < c_vectors; ++j) {
+          acc[i][j] += b[j] * pa[i];
+        }
+      }
+    }
+
+    T res[c_mr][c_nr];
+    std::memcpy(res, acc, sizeof(res));
+#else
+    // Without vector extensions (MSVC) the same slivers are multiplied by plain loops, left to the auto-vectorizer
+    T res[c_mr][c_nr] = {};
+    for (size_type p = 0; p < kc; ++p, pa += c_mr, pb += c_nr) {
+      for (size_type i = 0; i < c_mr; ++i) {
+        for (size_type j = 0; j < c_nr; ++j) {
+          res[i][j] += pa[i] * pb[j];
+        }
+      }
+    }
+#endif
+
+    for (size_type i = 0; i < rows; ++i) {
+      for (size_type j = 0; j < cols; ++j) {
+        c[i * ldc + j] = (overwrite ? res[i][j] : c[i * ldc + j] + res[i][j]);
+      }
+    }
+  }
+
+public:
+  cpu_matmult(unsigned threads = clutils::default_thread_count()) : m_threads{threads} {}
+
+  matrix_type operator()(const matrix_type &mata, const matrix_type &matb, profiling_info *time = nullptr) override {
+    if (mata.cols() != matb.rows()) throw std::invalid_argument{"Mismatched matrix sizes"};
+    const size_type m = mata.rows(), k = mata.cols(), n = matb.cols();
+
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    matrix_type matc = {m, n};
+    const T *a = mata.data(), *b = matb.data();
+    T *c = matc.data();
+
+    std::vector<T> packed_b(c_kc * round_up(std::min(c_nc, n), c_nr));
+    const auto row_slivers = (m + c_mr - 1) / c_mr;
+
+    for (size_type jc = 0; jc < n; jc += c_nc) {
+      const auto nc = std::min(c_nc, n - jc);
+      const auto col_slivers = (nc + c_nr - 1) / c_nr;
+
+      for (size_type pc = 0; pc < k; pc += c_kc) {
+        const auto kc = std::min(c_kc, k - pc);
+
+        clutils::parallel_chunks(
+            col_slivers,
+            [&](size_type first, size_type last) {
+              for (size_type s = first; s < last; ++s) {
+                const auto jr = s * c_nr;
+                pack_b(b + pc * n + jc + jr, n, kc, std::min(c_nr, nc - jr), packed_b.data() + jr * kc);
+              }
+            },
+            m_threads);
+
+        clutils::parallel_chunks(
+            row_slivers,
+            [&](size_type first, size_type last) {
+              std::vector<T> packed_a(c_mc * kc);
+              const auto end = std::min(last * c_mr, m);
+
+              for (size_type ic = first * c_mr; ic < end; ic += c_mc) {
+                const auto mc = std::min(c_mc, end - ic);
+                pack_a(a + ic * k + pc, k, mc, kc, packed_a.data());
+
+                for (size_type jr = 0; jr < nc; jr += c_nr) {
+                  for (size_type ir = 0; ir < mc; ir += c_mr) {
+                    micro_kernel(kc, packed_a.data() + ir * kc, packed_b.data() + jr * kc, c + (ic + ir) * n + jc + jr,
+                                 n, std::min(c_mr, mc - ir), std::min(c_nr, nc - jr), pc == 0);
+                  }
+                }
+              }
+            },
+            m_threads);
+      }
+    }
+
+    auto wall_end = std::chrono::high_resolution_clock::now();
+    if (time) {
+      const auto wall = std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start);
+      *time = {wall, wall};
+    }
+
+    return matc;
+  }
+};
+
+// Engines derived from gpu_matmult only enqueue the kernel that computes C = A * B. Host matrices are uploaded and
+// downloaded around it by operator(), device matrices are multiplied in place. Engines constructed from the same base
+// object share its context and queue, so their device matrices can be mixed.
+template <typename T> class gpu_matmult : public i_matmult<T>, protected clutils::platform_selector {
+public:
+  using typename i_matmult<T>::matrix_type;
+  using device_matrix_type = device_matrix<T>;
+
+protected:
+  cl::Context m_ctx;
+  cl::CommandQueue m_queue;
+
+  epilogue<T> m_epilogue;
+  cl::Buffer m_bias;
+
+  static constexpr clutils::platform_version c_api_version = {2, 2};
+
+  // Kernels always take the bias argument. Without a bias any buffer will do, since the epilogue doesn't read it. With
+  // one, the buffer is checked against the number of columns of C before the kernel reads past its end.
+  cl::Buffer bias_argument(cl::Buffer fallback, std::size_t cols) const {
+    if (!m_epilogue.bias) return fallback;
+    if (m_bias.getInfo<CL_MEM_SIZE>() < cols * sizeof(T))
+      throw std::invalid_argument{"Bias buffer is smaller than the number of columns of C"};
+    return m_bias;
+  }
+
+  // Engines whose kernels don't apply epilogues refuse bases that have one, rather than silently skipping it
+  void reject_epilogue(const char *engine) const {
+    if (!m_epilogue.empty()) throw std::invalid_argument{std::string{engine} + " engine doesn't support epilogues"};
+  }
+
+  // Throw if the engine can't multiply matrices of these sizes. Called before any transfers are done.
+  virtual void check_sizes(matrix_sizes) const {}
+
+  virtual cl::Event enqueue(cl::Buffer, cl::Buffer, cl::Buffer, matrix_sizes) {
+    throw std::logic_error{"Base GPU engine can't multiply matrices"};
+  } // Dummy implementation so that the class is no longer abstract
+
+  // Matrix by vector and other products with few columns in B leave most of a 2D NDRange idle. Engines with a GEMV
+  // kernel tell which shapes it should take, multiply and operator() then call enqueue_skinny instead of enqueue.
+  virtual bool routes_to_skinny(matrix_sizes) const { return false; }
+
+  virtual cl::Event enqueue_skinny(cl::Buffer, cl::Buffer, cl::Buffer, matrix_sizes) {
+    throw std::logic_error{"Engine doesn't have a GEMV kernel"};
+  }
+
+  // Engines that support general GEMM semantics override this one as well
+  virtual cl::Event enqueue_gemm(const gemm_arguments<T> &) {
+    throw std::runtime_error{"Engine doesn't support general matrix multiplication, use tiled or tiledarb"};
+  }
+
+  // Whether enqueue_gemm reads transposed operands in place. Other engines get them transposed on the device first.
+  virtual bool takes_transposed() const { return false; }
+
+  // Transpose of a rows x cols matrix from src into dst
+  virtual cl::Event enqueue_transpose(cl::Buffer, cl::Buffer, std::size_t, std::size_t) {
+    throw std::runtime_error{"Engine can't transpose matrices on the device"};
+  }
+
+  static void check_view(const matrix_view<T> &view) {
+    if (view.rows == 0 || view.cols == 0) throw std::invalid_argument{"Matrix view can't be empty"};
+    if (view.ld < view.cols) throw std::invalid_argument{"Leading dimension can't be less than the number of columns"};
+    const auto last = view.offset + (view.rows - 1) * view.ld + view.cols;
+    if (last * sizeof(T) > view.buffer.template getInfo<CL_MEM_SIZE>())
+      throw std::out_of_range{"Matrix view doesn't fit into its buffer"};
+  }
+
+  static matrix_sizes get_gemm_sizes(const gemm_arguments<T> &args) {
+    check_view(args.a);
+    check_view(args.b);
+    check_view(args.c);
+
+    const auto ax = (args.trans_a ? args.a.cols : args.a.rows), ay = (args.trans_a ? args.a.rows : args.a.cols);
+    const auto by_rows = (args.trans_b ? args.b.cols : args.b.rows), by = (args.trans_b ? args.b.rows : args.b.cols);
+    if (ay != by_rows || args.c.rows != ax || args.c.cols != by) throw std::invalid_argument{"Mismatched matrix sizes"};
+
+    return matrix_sizes{ax, ay, by};
+  }
+
+  // Views of dense matrices with the default C = A * B
+  static gemm_arguments<T> dense_arguments(cl::Buffer bufa, cl::Buffer bufb, cl::Buffer bufc, matrix_sizes sizes) {
+    return gemm_arguments<T>{.alpha = 1,
+                             .a = {bufa, sizes.ax, sizes.ay, sizes.ay},
+                             .b = {bufb, sizes.ay, sizes.by, sizes.by},
+                             .beta = 0,
+                             .c = {bufc, sizes.ax, sizes.by, sizes.by}};
+  }
+
+  cl::Event enqueue_routed(cl::Buffer bufa, cl::Buffer bufb, cl::Buffer bufc, matrix_sizes sizes, bool skinny) {
+    return (skinny ? enqueue_skinny(bufa, bufb, bufc, sizes) : enqueue(bufa, bufb, bufc, sizes));
+  }
+
+  // Multiply device matrices and wait, returns the first and the last event of the product
+  std::pair<cl::Event, cl::Event> run(const device_matrix_type &mata, const device_matrix_type &matb,
+                                      device_matrix_type &matc) {
+    const auto sizes = get_sizes(mata, matb);
+    if (matc.rows() != sizes.ax || matc.cols() != sizes.by) throw std::invalid_argument{"Mismatched matrix sizes"};
+    const bool skinny = routes_to_skinny(sizes);
+    if (!skinny) check_sizes(sizes);
+
+    auto event = enqueue_routed(mata.buffer(), matb.buffer(), matc.buffer(), sizes, skinny);
+    event.wait();
+    return {(skinny ? event : first_event(event)), event};
+  }
+
+  static matrix_sizes get_sizes(const auto &mata, const auto &matb) {
+    if (mata.cols() != matb.rows()) throw std::invalid_argument{"Mismatched matrix sizes"};
+    return matrix_sizes{mata.rows(), mata.cols(), matb.cols()};
+  }
+
+  // Engines that enqueue several commands per product return the last one from enqueue and the first one from here,
+  // so that pure time covers all of them
+  virtual cl::Event first_event(const cl::Event &last) const { return last; }
+
+  static profiling_info get_profiling_info(const cl::Event &event, auto wall_start, auto wall_end) {
+    return get_profiling_info(event, event, wall_start, wall_end);
+  }
+
+  static profiling_info get_profiling_info(const cl::Event &first, const cl::Event &last, auto wall_start,
+                                           auto wall_end) {
+    std::chrono::nanoseconds pure_start{first.getProfilingInfo<CL_PROFILING_COMMAND_START>()},
+        pure_end{last.getProfilingInfo<CL_PROFILING_COMMAND_END>()};
+
+    auto pure = std::chrono::duration_cast<std::chrono::milliseconds>(pure_end - pure_start);
+    auto wall = std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start);
+    return {pure, wall};
+  }
+
+public:
+  gpu_matmult()
+      : clutils::platform_selector{c_api_version}, m_ctx{m_device}, m_queue{m_ctx, cl::QueueProperties::Profiling} {}
+
+  // Whether there is a device that GPU engines can run on, so that callers can fall back to cpu_matmult
+  static bool available() {
+    try {
+      clutils::platform_selector selector{c_api_version, false};
+      return true;
+    } catch (cl::Error &) {
+      return false;
+    } catch (std::runtime_error &) {
+      return false;
+    }
+  }
+
+  template <long t_info> auto get_device_info() const { return m_device.getInfo<t_info>(); }
+
+  // Copy of the base that shares its context and queue, engines constructed from it compile the epilogue into their
+  // kernels. Bias is a buffer with one element per column of C.
+  gpu_matmult with_epilogue(const epilogue<T> &epi, cl::Buffer bias = {}) const {
+    epi.validate();
+    if (epi.bias && !bias.get()) throw std::invalid_argument{"Epilogue adds a bias, but no bias buffer was given"};
+    gpu_matmult res = *this;
+    res.m_epilogue = epi;
+    res.m_bias = bias;
+    return res;
+  }
+
+  const epilogue<T> &get_epilogue() const { return m_epilogue; }
+
+  // Uninitialized device matrix in the context of the engine
+  device_matrix_type allocate(std::size_t rows, std::size_t cols) const { return {m_ctx, rows, cols}; }
+
+  device_matrix_type upload(const matrix_type &mat) {
+    device_matrix_type res = {m_ctx, mat.rows(), mat.cols()};
+    auto buf = res.buffer();
+    cl::copy(m_queue, mat.begin(), mat.end(), buf);
+    return res;
+  }
+
+  matrix_type download(const device_matrix_type &mat) {
+    matrix_type res = {mat.rows(), mat.cols()};
+    cl::copy(m_queue, mat.buffer(), res.begin(), res.end());
+    return res;
+  }
+
+  // Whether tiled kernels with this shape fit into the work-group size and local memory of the device
+  bool fits(tile_shape shape, bool prefetch = false) const {
+    if (!shape.m || !shape.n || !shape.k) return false;
+    const std::size_t work_group = shape.m * shape.n, tiles = (prefetch ? 2 : 1) * (shape.m + shape.n) * shape.k;
+    return work_group <= get_device_info<CL_DEVICE_MAX_WORK_GROUP_SIZE>() &&
+           tiles * sizeof(T) <= get_device_info<CL_DEVICE_LOCAL_MEM_SIZE>();
+  }
+
+  // Whether products of these sizes go to the GEMV kernel instead of the engine's own kernel
+  bool goes_to_gemv(matrix_sizes sizes) const { return routes_to_skinny(sizes); }
+
+  // C = A * B for matrices that are already on the device. C should have the shape of the product.
+  void multiply(const device_matrix_type &mata, const device_matrix_type &matb, device_matrix_type &matc,
+                profiling_info *time = nullptr) {
+    auto wall_start = std::chrono::high_resolution_clock::now();
+    const auto [first, last] = run(mata, matb, matc);
+    auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (time) *time = get_profiling_info(first, last, wall_start, wall_end);
+  }
+
+  // Device time of C = A * B with nanosecond resolution, for tuning
+  std::chrono::nanoseconds device_time(const device_matrix_type &mata, const device_matrix_type &matb,
+                                       device_matrix_type &matc) {
+    const auto [first, last] = run(mata, matb, matc);
+    return std::chrono::nanoseconds{last.template getProfilingInfo<CL_PROFILING_COMMAND_END>() -
+                                    first.template getProfilingInfo<CL_PROFILING_COMMAND_START>()};
+  }
+
+  device_matrix_type multiply(const device_matrix_type &mata, const device_matrix_type &matb,
+                              profiling_info *time = nullptr) {
+    device_matrix_type matc = {m_ctx, mata.rows(), matb.cols()};
+    multiply(mata, matb, matc, time);
+    return matc;
+  }
+
+  using i_matmult<T>::multiply;
+
+  // C = op(A) * op(B) for host matrices, where op transposes a matrix when its flag is set. A column-major matrix is
+  // passed as its row-major transpose with the flag set, so no transposes are done on the host.
+  matrix_type multiply_transposed(const matrix_type &mata, bool trans_a, const matrix_type &matb, bool trans_b,
+                                  profiling_info *time = nullptr) {
+    if (!trans_a && !trans_b) return operator()(mata, matb, time);
+
+    const auto op_rows = [](const matrix_type &mat, bool trans) { return (trans ? mat.cols() : mat.rows()); };
+    const auto op_cols = [](const matrix_type &mat, bool trans) { return (trans ? mat.rows() : mat.cols()); };
+    if (op_cols(mata, trans_a) != op_rows(matb, trans_b)) throw std::invalid_argument{"Mismatched matrix sizes"};
+    const matrix_sizes sizes = {op_rows(mata, trans_a), op_cols(mata, trans_a), op_cols(matb, trans_b)};
+
+    const bool in_place = takes_transposed();
+    const bool skinny = !in_place && routes_to_skinny(sizes);
+    if (!skinny) check_sizes(sizes);
+
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    auto bufa = upload(mata), bufb = upload(matb);
+    device_matrix_type bufc = {m_ctx, sizes.ax, sizes.by};
+
+    cl::Event event;
+    std::optional<cl::Event> first;
+    if (in_place) {
+      event = enqueue_gemm({.alpha = 1,
+                            .a = bufa.view(),
+                            .trans_a = trans_a,
+                            .b = bufb.view(),
+                            .trans_b = trans_b,
+                            .beta = 0,
+                            .c = bufc.view()});
+    } else {
+      // Transposes go before the product on the in-order queue
+      const auto transpose_on_device = [this, &first](device_matrix_type &mat) {
+        device_matrix_type res = {m_ctx, mat.cols(), mat.rows()};
+        auto transposed = enqueue_transpose(mat.buffer(), res.buffer(), mat.rows(), mat.cols());
+        if (!first) first = transposed;
+        mat = res;
+      };
+
+      if (trans_a) transpose_on_device(bufa);
+      if (trans_b) transpose_on_device(bufb);
+      event = enqueue_routed(bufa.buffer(), bufb.buffer(), bufc.buffer(), sizes, skinny);
+    }
+
+    event.wait();
+    auto matc = download(bufc);
+
+    auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (time) {
+      *time = get_profiling_info(first.value_or(skinny ? event : first_event(event)), event, wall_start, wall_end);
+    }
+    return matc;
+  }
+
+  // Transpose of a matrix that is already on the device, done through local memory by the dense engines
+  device_matrix_type transpose(const device_matrix_type &mat, profiling_info *time = nullptr) {
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    device_matrix_type res = {m_ctx, mat.cols(), mat.rows()};
+    auto event = enqueue_transpose(mat.buffer(), res.buffer(), mat.rows(), mat.cols());
+    event.wait();
+
+    auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (time) *time = get_profiling_info(event, wall_start, wall_end);
+    return res;
+  }
+
+  // General GEMM on views of device buffers. Blocks of larger matrices are used in place without copies.
+  void gemm(const gemm_arguments<T> &args, profiling_info *time = nullptr) {
+    const auto sizes = get_gemm_sizes(args);
+    check_sizes(sizes);
+
+    auto wall_start = std::chrono::high_resolution_clock::now();
+    auto event = enqueue_gemm(args);
+    event.wait();
+    auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (time) *time = get_profiling_info(event, wall_start, wall_end);
+  }
+
+  matrix_type operator()(const matrix_type &mata, const matrix_type &matb, profiling_info *time = nullptr) override {
+    const auto sizes = get_sizes(mata, matb);
+    const bool skinny = routes_to_skinny(sizes);
+    if (!skinny) check_sizes(sizes);
+
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    auto bufa = upload(mata), bufb = upload(matb);
+    device_matrix_type bufc = {m_ctx, sizes.ax, sizes.by};
+
+    auto event = enqueue_routed(bufa.buffer(), bufb.buffer(), bufc.buffer(), sizes, skinny);
+    event.wait();
+    auto matc = download(bufc);
+
+    auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (time) *time = get_profiling_info(skinny ? event : first_event(event), event, wall_start, wall_end);
+    return matc;
+  }
+};
+
+// Base of the dense engines: products with at most c_skinny_cols columns in B and rows of A at least as long as the
+// work-group go to the GEMV kernel, where a work-group reduces one row of C and loads of A are coalesced. The kernel is
+// built on the first such product, so engines that never see one don't pay for it.
+template <typename T, typename t_name> class skinny_routed_matmult : public gpu_matmult<T> {
+  using kernel = matmult_gemv_kernel;
+  using transpose_kernel = matmult_transpose_kernel;
+
+public:
+  static constexpr std::size_t c_skinny_cols = 8;
+  static constexpr std::size_t c_work_group_size = 128;
+  static constexpr unsigned c_transpose_tile = 16;
+
+protected:
+  using gpu_matmult<T>::m_ctx;
+  using gpu_matmult<T>::m_queue;
+
+private:
+  cl::Program m_gemv_program;
+  kernel::functor_type m_gemv_functor;
+  std::size_t m_gemv_work_group = 0;
+
+  cl::Program m_transpose_program;
+  transpose_kernel::functor_type m_transpose_functor;
+  unsigned m_transpose_tile = 0;
+
+  std::size_t gemv_work_group() const {
+    if (m_gemv_work_group) return m_gemv_work_group;
+    const std::size_t device_max = gpu_matmult<T>::template get_device_info<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+    return std::bit_floor(std::clamp<std::size_t>(device_max, 1, c_work_group_size));
+  }
+
+protected:
+  // Only the first c_skinny_cols work-items write C, so a device that clamps the work-group below that keeps the
+  // dense kernels
+  bool routes_to_skinny(matrix_sizes sizes) const override {
+    const auto work_group = gemv_work_group();
+    return sizes.ax && sizes.by <= c_skinny_cols && work_group >= c_skinny_cols && sizes.ay >= work_group;
+  }
+
+  cl::Event enqueue_skinny(cl::Buffer bufa, cl::Buffer bufb, cl::Buffer bufc, matrix_sizes sizes) override {
+    if (!m_gemv_work_group) {
+      const auto work_group = gemv_work_group();
+      m_gemv_program = {m_ctx,
+                        kernel::source(t_name::name_str, unsigned(work_group), unsigned(c_skinny_cols),
+                                       this->m_epilogue.source()),
+                        true};
+      m_gemv_functor = {m_gemv_program, kernel::entry()};
+      m_gemv_work_group = work_group;
+    }
+
+    cl::EnqueueArgs args = {m_queue, cl::NDRange{sizes.ax * m_gemv_work_group}, cl::NDRange{m_gemv_work_group}};
+    return m_gemv_functor(args, bufa, bufb, bufc, sizes.ax, sizes.ay, sizes.by, this->bias_argument(bufc, sizes.by));
+  }
+
+  // The transpose kernel is built on first use as well
+  cl::Event enqueue_transpose(cl::Buffer src, cl::Buffer dst, std::size_t rows, std::size_t cols) override {
+    if (!m_transpose_tile) {
+      const std::size_t device_max = gpu_matmult<T>::template get_device_info<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+      unsigned tile = c_transpose_tile;
+      while (tile > 1 && tile * tile > device_max) {
+        tile /= 2;
+      }
+
+      m_transpose_program = {m_ctx, transpose_kernel::source(t_name::name_str, tile), true};
+      m_transpose_functor = {m_transpose_program, transpose_kernel::entry()};
+      m_transpose_tile = tile;
+    }
+
+    const auto round_up = [tile = m_transpose_tile](std::size_t sz) { return (sz + tile - 1) / tile * tile; };
+    cl::EnqueueArgs args = {m_queue, {round_up(cols), round_up(rows)}, {m_transpose_tile, m_transpose_tile}};
+    return m_transpose_functor(args, src, dst, rows, cols);
+  }
+
+public:
+  skinny_routed_matmult(gpu_matmult<T> base) : gpu_matmult<T>{base} {}
+};
+
+template <typename T, typename t_name> class naive_matmult : public skinny_routed_matmult<T, t_name> {
+  using kernel = matmult_naive_kernel;
+
+private:
+  using gpu_matmult<T>::m_ctx;
+  using gpu_matmult<T>::m_queue;
+
+  cl::Program m_program;
+  kernel::functor_type m_functor;
+
+protected:
+  cl::Event enqueue(cl::Buffer bufa, cl::Buffer bufb, cl::Buffer bufc, matrix_sizes sizes) override {
+    cl::EnqueueArgs args = {m_queue, {sizes.ax, sizes.by}};
+    return m_functor(args, bufa, bufb, bufc, sizes.ax, sizes.ay, sizes.by, this->bias_argument(bufc, sizes.by));
+  }
+
+public:
+  naive_matmult(gpu_matmult<T> base)
+      : skinny_routed_matmult<T, t_name>{base},
+        m_program{m_ctx, kernel::source(t_name::name_str, this->m_epilogue.source()), true},
+        m_functor{m_program, kernel::entry()} {}
+
+  naive_matmult() : naive_matmult{gpu_matmult<T>{}} {}
+};
+
+template <typename T, typename t_name> class tiled_matmult : public skinny_routed_matmult<T, t_name> {
+  using kernel = matmult_tiled_kernel;
+
+private:
+  using gpu_matmult<T>::m_ctx;
+  using gpu_matmult<T>::m_queue;
+
+  cl::Program m_program;
+  kernel::functor_type m_functor;
+
+  tile_shape m_shape;
+
+protected:
+  void check_sizes(matrix_sizes sizes) const override {
+    if (sizes.ax % m_shape.m != 0 || sizes.by % m_shape.n != 0 || sizes.ay % m_shape.k != 0)
+      throw std::invalid_argument{"Matrix sizes should be divisible by the tile shape"};
+  }
+
+  cl::Event enqueue(cl::Buffer bufa, cl::Buffer bufb, cl::Buffer bufc, matrix_sizes sizes) override {
+    return enqueue_gemm(gpu_matmult<T>::dense_arguments(bufa, bufb, bufc, sizes));
+  }
+
+  bool takes_transposed() const override { return true; }
+
+  cl::Event enqueue_gemm(const gemm_arguments<T> &gemm) override {
+    const auto sizes = gpu_matmult<T>::get_gemm_sizes(gemm);
+    cl::EnqueueArgs args = {m_queue, {sizes.ax, sizes.by}, {m_shape.m, m_shape.n}};
+    return m_functor(args, gemm.a.buffer, gemm.b.buffer, gemm.c.buffer, sizes.ax, sizes.ay, sizes.by, gemm.a.ld,
+                     gemm.b.ld, gemm.c.ld, gemm.a.offset, gemm.b.offset, gemm.c.offset, gemm.trans_a, gemm.trans_b,
+                     clutils::scalar_bits(gemm.alpha), clutils::scalar_bits(gemm.beta),
+                     this->bias_argument(gemm.c.buffer, sizes.by));
+  }
+
+public:
+  // With prefetch the kernel double buffers tiles in local memory and loads the next ones during computation
+  tiled_matmult(tile_shape shape, gpu_matmult<T> base, bool prefetch = false)
+      : skinny_routed_matmult<T, t_name>{base},
+        m_program{m_ctx,
+                  kernel::source(t_name::name_str, shape.m, shape.n, shape.k, unsigned{prefetch},
+                                 this->m_epilogue.source()),
+                  true},
+        m_functor{m_program, kernel::entry()}, m_shape{shape} {
+    if (!this->fits(shape, prefetch)) throw std::invalid_argument{"Tile shape doesn't fit into the device limits"};
+  }
+
+  tiled_matmult(unsigned tile_size, gpu_matmult<T> base, bool prefetch = false)
+      : tiled_matmult{tile_shape::square(tile_size), base, prefetch} {}
+
+  tiled_matmult(unsigned tile_size, bool prefetch = false) : tiled_matmult{tile_size, gpu_matmult<T>{}, prefetch} {}
+
+  tile_shape shape() const { return m_shape; }
+};
+
+template <typename T, typename t_name> class tiled_arbitrary_matmult : public skinny_routed_matmult<T, t_name> {
+  using kernel = matmult_tiled_arb_kernel;
+
+protected:
+  using gpu_matmult<T>::m_ctx;
+  using gpu_matmult<T>::m_queue;
+
+private:
+  cl::Program m_program;
+  kernel::functor_type m_functor;
+
+  tile_shape m_shape;
+
+protected:
+  cl::Event enqueue(cl::Buffer bufa, cl::Buffer bufb, cl::Buffer bufc, matrix_sizes sizes) override {
+    return enqueue_gemm(gpu_matmult<T>::dense_arguments(bufa, bufb, bufc, sizes));
+  }
+
+  bool takes_transposed() const override { return true; }
+
+  cl::Event enqueue_gemm(const gemm_arguments<T> &gemm) override {
+    const auto sizes = gpu_matmult<T>::get_gemm_sizes(gemm);
+    const auto recalc_size = [](std::size_t sz, unsigned tile_sz) {
+      if (sz % tile_sz == 0) return sz / tile_sz;
+      return (sz / tile_sz + 1);
+    };
+
+    auto recalc_rows = recalc_size(sizes.ax, m_shape.m) * m_shape.m;
+    auto recalc_cols = recalc_size(sizes.by, m_shape.n) * m_shape.n;
+
+    cl::EnqueueArgs args = {m_queue, {recalc_rows, recalc_cols}, {m_shape.m, m_shape.n}};
+
+    int tile_count = recalc_size(sizes.ay, m_shape.k);
+    return m_functor(args, gemm.a.buffer, gemm.b.buffer, gemm.c.buffer, sizes.ax, sizes.ay, sizes.by, tile_count,
+                     gemm.a.ld, gemm.b.ld, gemm.c.ld, gemm.a.offset, gemm.b.offset, gemm.c.offset, gemm.trans_a,
+                     gemm.trans_b, clutils::scalar_bits(gemm.alpha), clutils::scalar_bits(gemm.beta),
+                     this->bias_argument(gemm.c.buffer, sizes.by), 0, 0, 0, gemm.c.buffer);
+  }
+
+public:
+  tiled_arbitrary_matmult(tile_shape shape, gpu_matmult<T> base, bool prefetch = false)
+      : skinny_routed_matmult<T, t_name>{base},
+        m_program{m_ctx,
+                  kernel::source(t_name::name_str, shape.m, shape.n, shape.k, unsigned{prefetch}, 0u,
+                                 this->m_epilogue.source()),
+                  true},
+        m_functor{m_program, kernel::entry()}, m_shape{shape} {
+    if (!this->fits(shape, prefetch)) throw std::invalid_argument{"Tile shape doesn't fit into the device limits"};
+  }
+
+  tiled_arbitrary_matmult(unsigned tile_size, gpu_matmult<T> base, bool prefetch = false)
+      : tiled_arbitrary_matmult{tile_shape::square(tile_size), base, prefetch} {}
+
+  tiled_arbitrary_matmult(unsigned tile_size, bool prefetch = false)
+      : tiled_arbitrary_matmult{tile_size, gpu_matmult<T>{}, prefetch} {}
+
+  tile_shape shape() const { return m_shape; }
+};
+
+struct tile_timing {
+  tile_shape shape;
+  std::chrono::nanoseconds time;
+};
+
+// Powers of two from 4 to 64 in every dimension, with at least 16 work-items per work-group
+inline std::vector<tile_shape> candidate_tile_shapes() {
+  std::vector<tile_shape> shapes;
+  for (unsigned m = 4; m <= 64; m *= 2) {
+    for (unsigned n = 4; n <= 64; n *= 2) {
+      for (unsigned k = 4; k <= 64; k *= 2) {
+        if (m * n >= 16) shapes.push_back({m, n, k});
+      }
+    }
+  }
+  return shapes;
+}
+
+// Time a product of the given sizes with every shape that fits the device, taking the best of several runs, and return
+// the timings fastest first. t_engine is tiled_matmult or tiled_arbitrary_matmult; shapes that the engine can't
+// multiply these sizes with or that fail to build are skipped. Sizes that go to the GEMV kernel are rejected, since
+// every shape would time the same kernel.
+template <typename t_engine, typename T>
+std::vector<tile_timing> sweep_tile_shapes(gpu_matmult<T> base, matrix_sizes sizes, bool prefetch = false,
+                                           const std::vector<tile_shape> &shapes = candidate_tile_shapes(),
+                                           unsigned repeats = 3) {
+  host_matrix<T> ones_a = {sizes.ax, sizes.ay}, ones_b = {sizes.ay, sizes.by}, zeros_c = {sizes.ax, sizes.by};
+  std::fill(ones_a.begin(), ones_a.end(), T{1});
+  std::fill(ones_b.begin(), ones_b.end(), T{1});
+  auto mata = base.upload(ones_a), matb = base.upload(ones_b), matc = base.upload(zeros_c);
+
+  std::vector<tile_timing> timings;
+  for (const auto &shape : shapes) {
+    if (!base.fits(shape, prefetch)) continue;
+
+    std::optional<t_engine> engine;
+    try {
+      engine.emplace(shape, base, prefetch);
+    } catch (cl::BuildError &) {
+      continue; // The compiler can't handle this shape on the device
+    }
+
+    if (engine->goes_to_gemv(sizes))
+      throw std::invalid_argument{"Products of these sizes go to the GEMV kernel, which doesn't depend on tile shapes"};
+
+    try {
+      // The first run warms up the program
+      engine->device_time(mata, matb, matc);
+      auto best = std::chrono::nanoseconds::max();
+      for (unsigned i = 0; i < repeats; ++i) {
+        best = std::min(best, engine->device_time(mata, matb, matc));
+      }
+      timings.push_back({shape, best});
+    } catch (std::invalid_argument &) {
+      continue; // Sizes aren't divisible by the shape
+    }
+  }
+
+  std::stable_sort(timings.begin(), timings.end(),
+                   [](const auto &lhs, const auto &rhs) { return lhs.time < rhs.time; });
+  return timings;
+}
+
+template <typename T, typename t_name> class regblocked_matmult : public skinny_routed_matmult<T, t_name> {
+  using kernel = matmult_regblocked_kernel;
+
+private:
+  using gpu_matmult<T>::m_ctx;
+  using gpu_matmult<T>::m_queue;
+
+  cl::Program m_program;
+  kernel::functor_type m_functor;
+
+  unsigned m_tile_size, m_tile_depth, m_work_per_item;
+
+  // Sizes are checked before the program is built for them, which would fail with a build log or waste a compilation
+  static std::string source(unsigned tile_size, unsigned tile_depth, unsigned work_per_item, const epilogue<T> &epi) {
+    if (work_per_item != 4 && work_per_item != 8)
+      throw std::invalid_argument{"Number of elements per work-item must be 4 or 8"};
+    if (tile_size % work_per_item != 0 || tile_depth % work_per_item != 0)
+      throw std::invalid_argument{"Tile size and depth should be divisible by the number of elements per work-item"};
+    return kernel::source(t_name::name_str, tile_size, tile_depth, work_per_item, epi.source());
+  }
+
+protected:
+  void check_sizes(matrix_sizes sizes) const override {
+    if (sizes.ax % m_tile_size != 0 || sizes.by % m_tile_size != 0 || sizes.ay % m_tile_depth != 0)
+      throw std::invalid_argument{"Matrix sizes should be divisible by the tile size and depth"};
+  }
+
+  cl::Event enqueue(cl::Buffer bufa, cl::Buffer bufb, cl::Buffer bufc, matrix_sizes sizes) override {
+    const auto items = m_tile_size / m_work_per_item;
+    cl::EnqueueArgs args = {m_queue, {sizes.ax / m_work_per_item, sizes.by / m_work_per_item}, {items, items}};
+    return m_functor(args, bufa, bufb, bufc, sizes.ax, sizes.ay, sizes.by, this->bias_argument(bufc, sizes.by));
+  }
+
+public:
+  // Each work-group computes a tile_size x tile_size block of C, every work-item a work_per_item x work_per_item part
+  // of it. Tiles of A and B are tile_depth deep.
+  regblocked_matmult(unsigned tile_size, unsigned tile_depth, unsigned work_per_item, gpu_matmult<T> base)
+      : skinny_routed_matmult<T, t_name>{base},
+        m_program{m_ctx, source(tile_size, tile_depth, work_per_item, this->m_epilogue), true},
+        m_functor{m_program, kernel::entry()}, m_tile_size{tile_size}, m_tile_depth{tile_depth},
+        m_work_per_item{work_per_item} {}
+
+  regblocked_matmult(unsigned tile_size, unsigned tile_depth, unsigned work_per_item)
+      : regblocked_matmult{tile_size, tile_depth, work_per_item, gpu_matmult<T>{}} {}
+};
+
+// Many products of equal-shape matrices in one launch: dimension 2 of the NDRange enumerates the batch, so small
+// matrices don't pay for a launch, allocations and a blocking wait each. Products are computed by the tiledarb kernel,
+// with its tile shapes, prefetch and epilogue, and the same bias is added to every product.
+template <typename T, typename t_name> class batched_matmult : public gpu_matmult<T> {
+  using kernel = matmult_tiled_arb_kernel;
+
+public:
+  using typename gpu_matmult<T>::matrix_type;
+  using size_type = std::size_t;
+
+private:
+  using gpu_matmult<T>::m_ctx;
+  using gpu_matmult<T>::m_queue;
+  using gpu_matmult<T>::get_profiling_info;
+
+  cl::Program m_program_strided, m_program_indirect;
+  kernel::functor_type m_functor_strided, m_functor_indirect;
+
+  tile_shape m_shape;
+
+  static std::string source(tile_shape shape, bool prefetch, bool indirect, const epilogue<T> &epi) {
+    return kernel::source(t_name::name_str, shape.m, shape.n, shape.k, unsigned{prefetch}, unsigned{indirect},
+                          epi.source());
+  }
+
+  cl::EnqueueArgs batch_args(matrix_sizes sizes, size_type batch) const {
+    const auto round_up = [](size_type sz, unsigned tile) { return (sz + tile - 1) / tile * tile; };
+    return cl::EnqueueArgs{m_queue,
+                           {round_up(sizes.ax, m_shape.m), round_up(sizes.by, m_shape.n), batch},
+                           {m_shape.m, m_shape.n, 1}};
+  }
+
+  int tile_count(matrix_sizes sizes) const { return (sizes.ay + m_shape.k - 1) / m_shape.k; }
+
+  // Every product of the batch is a dense C = A * B with its own offsets
+  cl::Event run_batch(kernel::functor_type &functor, cl::Buffer bufa, cl::Buffer bufb, cl::Buffer bufc,
+                      matrix_sizes sizes, size_type batch, batch_strides strides, cl::Buffer offsets) {
+    return functor(batch_args(sizes, batch), bufa, bufb, bufc, sizes.ax, sizes.ay, sizes.by, tile_count(sizes),
+                   sizes.ay, sizes.by, sizes.by, 0, 0, 0, 0, 0, clutils::scalar_bits(T{1}), clutils::scalar_bits(T{0}),
+                   this->bias_argument(bufc, sizes.by), strides.a, strides.b, strides.c, offsets);
+  }
+
+  void finish(cl::Event event, auto wall_start, profiling_info *time) const {
+    event.wait();
+    auto wall_end = std::chrono::high_resolution_clock::now();
+    if (time) *time = get_profiling_info(event, wall_start, wall_end);
+  }
+
+protected:
+  cl::Event enqueue(cl::Buffer bufa, cl::Buffer bufb, cl::Buffer bufc, matrix_sizes sizes) override {
+    return enqueue_strided(bufa, bufb, bufc, sizes, 1, batch_strides{0, 0, 0});
+  }
+
+public:
+  batched_matmult(tile_shape shape, gpu_matmult<T> base, bool prefetch = false)
+      : gpu_matmult<T>{base}, m_program_strided{m_ctx, source(shape, prefetch, false, this->m_epilogue), true},
+        m_program_indirect{m_ctx, source(shape, prefetch, true, this->m_epilogue), true},
+        m_functor_strided{m_program_strided, kernel::entry()}, m_functor_indirect{m_program_indirect, kernel::entry()},
+        m_shape{shape} {
+    if (!this->fits(shape, prefetch)) throw std::invalid_argument{"Tile shape doesn't fit into the device limits"};
+  }
+
+  batched_matmult(unsigned tile_size, gpu_matmult<T> base, bool prefetch = false)
+      : batched_matmult{tile_shape::square(tile_size), base, prefetch} {}
+
+  batched_matmult(unsigned tile_size, bool prefetch = false)
+      : batched_matmult{tile_size, gpu_matmult<T>{}, prefetch} {}
+
+  tile_shape shape() const { return m_shape; }
+
+  // Product i multiplies matrices that start at i * strides.a of bufa and i * strides.b of bufb into bufc. The strided
+  // kernel doesn't read offsets, so any buffer is passed for them.
+  cl::Event enqueue_strided(cl::Buffer bufa, cl::Buffer bufb, cl::Buffer bufc, matrix_sizes sizes, size_type batch,
+                            batch_strides strides) {
+    return run_batch(m_functor_strided, bufa, bufb, bufc, sizes, batch, strides, bufc);
+  }
+
+  // Offsets is a buffer of batch_offsets structures, one per product
+  cl::Event enqueue_indirect(cl::Buffer bufa, cl::Buffer bufb, cl::Buffer bufc, matrix_sizes sizes, size_type batch,
+                             cl::Buffer offsets) {
+    return run_batch(m_functor_indirect, bufa, bufb, bufc, sizes, batch, batch_strides{0, 0, 0}, offsets);
+  }
+
+  void multiply_strided(cl::Buffer bufa, cl::Buffer bufb, cl::Buffer bufc, matrix_sizes sizes, size_type batch,
+                        batch_strides strides, profiling_info *time = nullptr) {
+    if (batch == 0) return;
+    auto wall_start = std::chrono::high_resolution_clock::now();
+    finish(enqueue_strided(bufa, bufb, bufc, sizes, batch, strides), wall_start, time);
+  }
+
+  void multiply_indirect(cl::Buffer bufa, cl::Buffer bufb, cl::Buffer bufc, matrix_sizes sizes,
+                         std::span<const batch_offsets> offsets, profiling_info *time = nullptr) {
+    if (offsets.empty()) return;
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    cl::Buffer offsets_buf = {m_ctx, CL_MEM_READ_ONLY, clutils::sizeof_container(offsets)};
+    cl::copy(m_queue, offsets.begin(), offsets.end(), offsets_buf);
+    finish(enqueue_indirect(bufa, bufb, bufc, sizes, offsets.size(), offsets_buf), wall_start, time);
+  }
+
+  // Returns products mata[i] * matb[i]. Matrices are packed into one buffer per operand, so the whole batch takes
+  // three transfers and a single launch.
+  std::vector<matrix_type> multiply_batch(std::span<const matrix_type> mata, std::span<const matrix_type> matb,
+                                          profiling_info *time = nullptr) {
+    if (mata.size() != matb.size()) throw std::invalid_argument{"Batches should have the same length"};
+    if (mata.empty()) return {};
+
+    const auto sizes = this->get_sizes(mata.front(), matb.front());
+    for (size_type i = 0; i < mata.size(); ++i) {
+      if (mata[i].rows() != sizes.ax || mata[i].cols() != sizes.ay || matb[i].rows() != sizes.ay ||
+          matb[i].cols() != sizes.by)
+        throw std::invalid_argument{"All matrices of a batch should have the same shape"};
+    }
+
+    const size_type batch = mata.size();
+    const batch_strides strides = {sizes.ax * sizes.ay, sizes.ay * sizes.by, sizes.ax * sizes.by};
+
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    const auto pack = [batch](auto mats, size_type stride) {
+      std::vector<T> packed;
+      packed.reserve(batch * stride);
+      for (const auto &m : mats) {
+        packed.insert(packed.end(), m.begin(), m.end());
+      }
+      return packed;
+    };
+
+    const auto packed_a = pack(mata, strides.a), packed_b = pack(matb, strides.b);
+    std::vector<T> packed_c;
+    packed_c.resize(batch * strides.c);
+
+    cl::Buffer bufa = {m_ctx, CL_MEM_READ_ONLY, clutils::sizeof_container(packed_a)};
+    cl::Buffer bufb = {m_ctx, CL_MEM_READ_ONLY, clutils::sizeof_container(packed_b)};
+    cl::Buffer bufc = {m_ctx, CL_MEM_WRITE_ONLY, clutils::sizeof_container(packed_c)};
+
+    cl::copy(m_queue, packed_a.begin(), packed_a.end(), bufa);
+    cl::copy(m_queue, packed_b.begin(), packed_b.end(), bufb);
+
+    auto event = enqueue_strided(bufa, bufb, bufc, sizes, batch, strides);
+    event.wait();
+    cl::copy(m_queue, bufc, packed_c.begin(), packed_c.end());
+
+    std::vector<matrix_type> res;
+    res.reserve(batch);
+    for (size_type i = 0; i < batch; ++i) {
+      matrix_type matc = {sizes.ax, sizes.by};
+      const auto start = packed_c.begin() + i * strides.c;
+      std::copy(start, start + strides.c, matc.begin());
+      res.push_back(std::move(matc));
+    }
+
+    auto wall_end = std::chrono::high_resolution_clock::now();
+    if (time) *time = get_profiling_info(event, wall_start, wall_end);
+
+    return res;
+  }
+};
+
+// Device storage of A and B for mixed_matmult. Values are listed as kernels/matmult_mixed.cl expects them in FORMAT.
+enum class storage_format : unsigned { half = 0, bfloat16 = 1, int8 = 2 };
+
+// Products of T matrices with A and B stored on the device as half, bfloat16 or int8 and accumulated in float, float
+// and int respectively. Inputs are rounded to the storage format on upload and the product is converted back to T.
+// Device matrices of T can't be multiplied, since they aren't stored in the reduced format.
+template <typename T> class mixed_matmult : public gpu_matmult<T> {
+  using kernel = matmult_mixed_kernel;
+
+public:
+  using typename gpu_matmult<T>::matrix_type;
+
+private:
+  using gpu_matmult<T>::m_ctx;
+  using gpu_matmult<T>::m_queue;
+  using gpu_matmult<T>::get_sizes;
+  using gpu_matmult<T>::get_profiling_info;
+
+  cl::Program m_program;
+  kernel::functor_type m_functor;
+
+  storage_format m_format;
+  unsigned m_tile_size;
+
+  bool accumulates_float() const { return m_format != storage_format::int8; }
+
+  template <typename t_storage> cl::Buffer pack(const matrix_type &mat, auto convert) {
+    std::vector<t_storage> packed(mat.rows() * mat.cols());
+    std::transform(mat.begin(), mat.end(), packed.begin(), convert);
+
+    cl::Buffer buf = {m_ctx, CL_MEM_READ_ONLY, packed.size() * sizeof(t_storage)};
+    cl::copy(m_queue, packed.begin(), packed.end(), buf);
+    return buf;
+  }
+
+  cl::Buffer upload_packed(const matrix_type &mat) {
+    switch (m_format) {
+    case storage_format::half:
+      return pack<cl_ushort>(mat, [](T value) { return clutils::float_to_half_bits(static_cast<float>(value)); });
+    case storage_format::bfloat16:
+      return pack<cl_ushort>(mat, [](T value) { return clutils::float_to_bfloat16_bits(static_cast<float>(value)); });
+    case storage_format::int8:
+      return pack<cl_char>(mat, [](T value) {
+        const auto rounded = std::llround(static_cast<double>(value));
+        if (rounded < -128 || rounded > 127) throw std::out_of_range{"Value doesn't fit into int8 storage"};
+        return static_cast<cl_char>(rounded);
+      });
+    }
+    throw std::invalid_argument{"Unknown storage format"};
+  }
+
+  template <typename t_accum> matrix_type unpack(cl::Buffer buf, matrix_sizes sizes) {
+    std::vector<t_accum> wide(sizes.ax * sizes.by);
+    cl::copy(m_queue, buf, wide.begin(), wide.end());
+
+    matrix_type res = {sizes.ax, sizes.by};
+    std::transform(wide.begin(), wide.end(), res.begin(), [](t_accum value) {
+      constexpr bool needs_rounding = std::is_integral_v<T> && std::is_floating_point_v<t_accum>;
+      if constexpr (needs_rounding) return static_cast<T>(std::llround(value));
+      else return static_cast<T>(value);
+    });
+    return res;
+  }
+
+protected:
+  cl::Event enqueue(cl::Buffer, cl::Buffer, cl::Buffer, matrix_sizes) override {
+    throw std::logic_error{"Mixed precision engine only multiplies host matrices"};
+  }
+
+public:
+  mixed_matmult(storage_format format, unsigned tile_size, gpu_matmult<T> base)
+      : gpu_matmult<T>{base}, m_program{m_ctx, kernel::source(tile_size, static_cast<unsigned>(format)), true},
+        m_functor{m_program, kernel::entry()}, m_format{format}, m_tile_size{tile_size} {
+    this->reject_epilogue("Mixed precision");
+  }
+
+  mixed_matmult(storage_format format, unsigned tile_size) : mixed_matmult{format, tile_size, gpu_matmult<T>{}} {}
+
+  storage_format format() const { return m_format; }
+
+  matrix_type operator()(const matrix_type &mata, const matrix_type &matb, profiling_info *time = nullptr) override {
+    const auto sizes = get_sizes(mata, matb);
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    auto bufa = upload_packed(mata), bufb = upload_packed(matb);
+    const auto accum_size = (accumulates_float() ? sizeof(cl_float) : sizeof(cl_int));
+    cl::Buffer bufc = {m_ctx, CL_MEM_WRITE_ONLY, sizes.ax * sizes.by * accum_size};
+
+    const auto round_up = [tile = m_tile_size](std::size_t sz) { return (sz + tile - 1) / tile * tile; };
+    cl::EnqueueArgs args = {m_queue, {round_up(sizes.ax), round_up(sizes.by)}, {m_tile_size, m_tile_size}};
+    const int tile_count = (sizes.ay + m_tile_size - 1) / m_tile_size;
+
+    auto event = m_functor(args, bufa, bufb, bufc, sizes.ax, sizes.ay, sizes.by, tile_count);
+    event.wait();
+    auto matc = (accumulates_float() ? unpack<cl_float>(bufc, sizes) : unpack<cl_int>(bufc, sizes));
+
+    auto wall_end = std::chrono::high_resolution_clock::now();
+    if (time) *time = get_profiling_info(event, wall_start, wall_end);
+    return matc;
+  }
+};
+
+// Products of matrices that don't fit into device memory. C is computed block by block: panels of A and B are copied
+// from the host matrices into one of two upload slots on a separate transfer queue, while the compute queue multiplies
+// the panels in the other slot and accumulates into the C block with beta = 1. Finished C blocks are read back on the
+// transfer queue as well, so only the first upload is not hidden behind computation.
+template <typename T, typename t_name> class out_of_core_matmult : public tiled_arbitrary_matmult<T, t_name> {
+public:
+  using typename gpu_matmult<T>::matrix_type;
+  using size_type = std::size_t;
+
+private:
+  using gpu_matmult<T>::m_ctx;
+  using gpu_matmult<T>::m_queue;
+  using gpu_matmult<T>::m_device;
+
+  cl::CommandQueue m_transfer_queue;
+  size_type m_block;
+
+  // One step multiplies the A panel at (row, depth) by the B panel at (depth, col) into the C block at (row, col)
+  struct step {
+    size_type row, col, depth, rows, cols, depths;
+    bool first, last;
+  };
+
+  struct interval {
+    cl_ulong start, end;
+  };
+
+  // Two upload slots for panels of A and B and two C blocks, while half of the memory is left to everything else
+  size_type default_block(unsigned tile_size) const {
+    const auto global_mem = m_device.template getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+    const auto max_alloc = m_device.template getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+    const auto elements = std::min<cl_ulong>(global_mem / 2 / 6, max_alloc) / sizeof(T);
+
+    auto block = static_cast<size_type>(std::sqrt(static_cast<double>(elements)));
+    block -= block % tile_size;
+    if (block == 0) throw std::runtime_error{"Device memory is too small for out-of-core multiplication"};
+    return block;
+  }
+
+  std::vector<step> split(matrix_sizes sizes) const {
+    std::vector<step> steps;
+    for (size_type row = 0; row < sizes.ax; row += m_block) {
+      for (size_type col = 0; col < sizes.by; col += m_block) {
+        for (size_type depth = 0; depth < sizes.ay; depth += m_block) {
+          steps.push_back({row, col, depth, std::min(m_block, sizes.ax - row), std::min(m_block, sizes.by - col),
+                           std::min(m_block, sizes.ay - depth), depth == 0, depth + m_block >= sizes.ay});
+        }
+      }
+    }
+    return steps;
+  }
+
+  static std::vector<interval> get_intervals(const std::vector<cl::Event> &events) {
+    std::vector<interval> res;
+    res.reserve(events.size());
+    for (const auto &event : events) {
+      res.push_back(
+          {event.getProfilingInfo<CL_PROFILING_COMMAND_START>(), event.getProfilingInfo<CL_PROFILING_COMMAND_END>()});
+    }
+    std::sort(res.begin(), res.end(), [](auto lhs, auto rhs) { return lhs.start < rhs.start; });
+    return res;
+  }
+
+  static cl_ulong busy_time(const std::vector<interval> &intervals) {
+    cl_ulong total = 0;
+    for (auto v : intervals) {
+      total += v.end - v.start;
+    }
+    return total;
+  }
+
+  // Commands of an in-order queue don't overlap with each other, so each list is a sorted set of disjoint intervals
+  static cl_ulong overlap_time(const std::vector<interval> &lhs, const std::vector<interval> &rhs) {
+    cl_ulong total = 0;
+    for (size_type i = 0, j = 0; i < lhs.size() && j < rhs.size();) {
+      const auto start = std::max(lhs[i].start, rhs[j].start), end = std::min(lhs[i].end, rhs[j].end);
+      if (start < end) total += end - start;
+      if (lhs[i].end < rhs[j].end) ++i;
+      else ++j;
+    }
+    return total;
+  }
+
+public:
+  // Panels are at most block x block elements. Zero picks the largest block, rounded down to a multiple of the tile
+  // size, for which the slots take up half of the device memory.
+  out_of_core_matmult(unsigned tile_size, size_type block, gpu_matmult<T> base, bool prefetch = false)
+      : tiled_arbitrary_matmult<T, t_name>{tile_size, base, prefetch},
+        m_transfer_queue{m_ctx, m_device, cl::QueueProperties::Profiling},
+        m_block{block ? block : default_block(tile_size)} {
+    // Panels are accumulated into C, so an epilogue would be applied to partial sums
+    this->reject_epilogue("Out-of-core");
+  }
+
+  out_of_core_matmult(unsigned tile_size, size_type block = 0, bool prefetch = false)
+      : out_of_core_matmult{tile_size, block, gpu_matmult<T>{}, prefetch} {}
+
+  size_type block() const { return m_block; }
+
+  matrix_type multiply_streamed(const matrix_type &mata, const matrix_type &matb, profiling_info *time = nullptr,
+                                streaming_info *streaming = nullptr) {
+    const auto sizes = gpu_matmult<T>::get_sizes(mata, matb);
+    const auto steps = split(sizes);
+
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    const auto block_rows = std::min(m_block, sizes.ax), block_cols = std::min(m_block, sizes.by),
+               block_depth = std::min(m_block, sizes.ay);
+    std::array<cl::Buffer, 2> slots_a, slots_b, blocks_c;
+    for (unsigned i = 0; i < 2; ++i) {
+      slots_a[i] = cl::Buffer{m_ctx, CL_MEM_READ_ONLY, block_rows * block_depth * sizeof(T)};
+      slots_b[i] = cl::Buffer{m_ctx, CL_MEM_READ_ONLY, block_depth * block_cols * sizeof(T)};
+      blocks_c[i] = cl::Buffer{m_ctx, CL_MEM_READ_WRITE, block_rows * block_cols * sizeof(T)};
+    }
+
+    matrix_type matc = {sizes.ax, sizes.by};
+
+    // An upload slot is free once the product that reads it is done, a C block once it's read back
+    std::array<std::vector<cl::Event>, 2> slot_free, block_free, uploaded;
+    std::vector<cl::Event> transfers, products;
+
+    const auto upload_panels = [&](size_type index) {
+      const auto &cur = steps[index];
+      const auto slot = index % 2;
+      cl::Event event_a, event_b;
+
+      m_transfer_queue.enqueueWriteBufferRect(slots_a[slot], CL_FALSE, {0, 0, 0}, {cur.depth * sizeof(T), cur.row, 0},
+                                              {cur.depths * sizeof(T), cur.rows, 1}, cur.depths * sizeof(T), 0,
+                                              sizes.ay * sizeof(T), 0, mata.data(), &slot_free[slot], &event_a);
+      m_transfer_queue.enqueueWriteBufferRect(slots_b[slot], CL_FALSE, {0, 0, 0}, {cur.col * sizeof(T), cur.depth, 0},
+                                              {cur.cols * sizeof(T), cur.depths, 1}, cur.cols * sizeof(T), 0,
+                                              sizes.by * sizeof(T), 0, matb.data(), nullptr, &event_b);
+
+      uploaded[slot] = {event_a, event_b};
+      transfers.push_back(event_a);
+      transfers.push_back(event_b);
+    };
+
+    if (!steps.empty()) upload_panels(0);
+    for (size_type index = 0, block_index = 0; index < steps.size(); ++index) {
+      const auto &cur = steps[index];
+      const auto slot = index % 2, cslot = block_index % 2;
+
+      // Next panels go to the other slot while this product runs
+      if (index + 1 < steps.size()) upload_panels(index + 1);
+
+      auto wait = uploaded[slot];
+      if (cur.first) wait.insert(wait.end(), block_free[cslot].begin(), block_free[cslot].end());
+      m_queue.enqueueBarrierWithWaitList(&wait);
+
+      auto product = this->enqueue_gemm({.alpha = 1,
+                                         .a = {slots_a[slot], cur.rows, cur.depths, cur.depths},
+                                         .b = {slots_b[slot], cur.depths, cur.cols, cur.cols},
+                                         .beta = (cur.first ? T{0} : T{1}),
+                                         .c = {blocks_c[cslot], cur.rows, cur.cols, cur.cols}});
+      slot_free[slot] = {product};
+      products.push_back(product);
+
+      if (!cur.last) continue;
+
+      std::vector<cl::Event> computed = {product};
+      cl::Event event;
+      m_transfer_queue.enqueueReadBufferRect(blocks_c[cslot], CL_FALSE, {0, 0, 0}, {cur.col * sizeof(T), cur.row, 0},
+                                             {cur.cols * sizeof(T), cur.rows, 1}, cur.cols * sizeof(T), 0,
+                                             sizes.by * sizeof(T), 0, matc.data(), &computed, &event);
+      block_free[cslot] = {event};
+      transfers.push_back(event);
+      ++block_index;
+    }
+
+    m_queue.finish();
+    m_transfer_queue.finish();
+    auto wall_end = std::chrono::high_resolution_clock::now();
+
+    const auto transfer_intervals = get_intervals(transfers), product_intervals = get_intervals(products);
+    const auto to_ms = [](cl_ulong ns) {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::nanoseconds{ns});
+    };
+
+    if (time) {
+      time->pure = to_ms(busy_time(product_intervals));
+      time->wall = std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start);
+    }
+
+    if (streaming) {
+      *streaming = {to_ms(busy_time(transfer_intervals)), to_ms(busy_time(product_intervals)),
+                    to_ms(overlap_time(transfer_intervals, product_intervals))};
+    }
+
+    return matc;
+  }
+
+  matrix_type operator()(const matrix_type &mata, const matrix_type &matb, profiling_info *time = nullptr) override {
+    return multiply_streamed(mata, matb, time);
+  }
+};
+
+// Strassen-Winograd on top of the tiledarb kernel: seven products of half-size blocks instead of eight per step, until
+// the smallest dimension drops to the cutoff or becomes odd. Blocks of the inputs are used in place through views, the
+// eight operand sums and the seven output sums of a step are done by two fused elementwise kernels each.
+template <typename T, typename t_name> class strassen_matmult : public tiled_arbitrary_matmult<T, t_name> {
+  using operands_kernel = matmult_strassen_operands_kernel;
+  using combine_kernel = matmult_strassen_combine_kernel;
+
+public:
+  using typename gpu_matmult<T>::matrix_type;
+  using size_type = std::size_t;
+
+private:
+  using gpu_matmult<T>::m_ctx;
+  using gpu_matmult<T>::m_queue;
+
+  cl::Program m_operands_program, m_combine_program;
+  operands_kernel::functor_type m_operands_functor;
+  combine_kernel::functor_type m_combine_functor;
+
+  size_type m_cutoff;
+  cl::Event m_first;
+
+  // Sums of quadrants of A and B and the seven products of one step. Steps at the same depth run one after another on
+  // the in-order queue, so they share a workspace.
+  struct workspace {
+    cl::Buffer operands_a, operands_b, products;
+  };
+
+  static matrix_view<T> quadrant(const matrix_view<T> &view, unsigned row, unsigned col) {
+    const auto rows = view.rows / 2, cols = view.cols / 2;
+    return {view.buffer, rows, cols, view.ld, view.offset + row * rows * view.ld + col * cols};
+  }
+
+  static matrix_view<T> slice(cl::Buffer buf, size_type rows, size_type cols, unsigned index) {
+    return {buf, rows, cols, cols, index * rows * cols};
+  }
+
+  workspace &get_workspace(std::vector<workspace> &workspaces, unsigned depth, size_type m, size_type k, size_type n) {
+    if (depth == workspaces.size()) {
+      workspaces.push_back({cl::Buffer{m_ctx, CL_MEM_READ_WRITE, 4 * m * k * sizeof(T)},
+                            cl::Buffer{m_ctx, CL_MEM_READ_WRITE, 4 * k * n * sizeof(T)},
+                            cl::Buffer{m_ctx, CL_MEM_READ_WRITE, 7 * m * n * sizeof(T)}});
+    }
+    return workspaces[depth];
+  }
+
+  cl::Event enqueue_operands(const matrix_view<T> &view, cl::Buffer out, bool of_b) {
+    const auto rows = view.rows / 2, cols = view.cols / 2;
+    cl::EnqueueArgs args = {m_queue, {rows, cols}};
+    return m_operands_functor(args, view.buffer, view.ld, view.offset, out, rows, cols, of_b);
+  }
+
+  cl::Event enqueue_combine(cl::Buffer products, const matrix_view<T> &view) {
+    const auto rows = view.rows / 2, cols = view.cols / 2;
+    cl::EnqueueArgs args = {m_queue, {rows, cols}};
+    return m_combine_functor(args, products, view.buffer, view.ld, view.offset, rows, cols);
+  }
+
+  cl::Event recurse(const matrix_view<T> &a, const matrix_view<T> &b, const matrix_view<T> &c,
+                    std::vector<workspace> &workspaces, unsigned depth) {
+    const auto m = a.rows, k = a.cols, n = b.cols;
+    if (std::min({m, k, n}) <= m_cutoff || m % 2 || k % 2 || n % 2) {
+      return this->enqueue_gemm({.alpha = 1, .a = a, .b = b, .beta = 0, .c = c});
+    }
+
+    const auto hm = m / 2, hk = k / 2, hn = n / 2;
+    // Copied, since deeper steps may reallocate the vector
+    const auto ws = get_workspace(workspaces, depth, hm, hk, hn);
+
+    enqueue_operands(a, ws.operands_a, false);
+    enqueue_operands(b, ws.operands_b, true);
+
+    const auto s = [&](unsigned i) { return slice(ws.operands_a, hm, hk, i - 1); };
+    const auto t = [&](unsigned i) { return slice(ws.operands_b, hk, hn, i - 1); };
+    const auto p = [&](unsigned i) { return slice(ws.products, hm, hn, i - 1); };
+
+    recurse(quadrant(a, 0, 0), quadrant(b, 0, 0), p(1), workspaces, depth + 1);
+    recurse(quadrant(a, 0, 1), quadrant(b, 1, 0), p(2), workspaces, depth + 1);
+    recurse(s(4), quadrant(b, 1, 1), p(3), workspaces, depth + 1);
+    recurse(quadrant(a, 1, 1), t(4), p(4), workspaces, depth + 1);
+    recurse(s(1), t(1), p(5), workspaces, depth + 1);
+    recurse(s(2), t(2), p(6), workspaces, depth + 1);
+    recurse(s(3), t(3), p(7), workspaces, depth + 1);
+
+    return enqueue_combine(ws.products, c);
+  }
+
+protected:
+  cl::Event enqueue(cl::Buffer bufa, cl::Buffer bufb, cl::Buffer bufc, matrix_sizes sizes) override {
+    const auto args = gpu_matmult<T>::dense_arguments(bufa, bufb, bufc, sizes);
+    std::vector<workspace> workspaces;
+
+    // Marks the start of the whole recursion for profiling
+    m_queue.enqueueMarkerWithWaitList(nullptr, &m_first);
+    return recurse(args.a, args.b, args.c, workspaces, 0);
+  }
+
+  cl::Event first_event(const cl::Event &) const override { return m_first; }
+
+  // Transposed operands would send the whole product to tiledarb through enqueue_gemm, so they are transposed first
+  bool takes_transposed() const override { return false; }
+
+public:
+  // Products whose smallest dimension is at most cutoff are left to the classic kernel
+  strassen_matmult(unsigned tile_size, size_type cutoff, gpu_matmult<T> base, bool prefetch = false)
+      : tiled_arbitrary_matmult<T, t_name>{tile_size, base, prefetch},
+        m_operands_program{m_ctx, operands_kernel::source(t_name::name_str), true},
+        m_combine_program{m_ctx, combine_kernel::source(t_name::name_str), true},
+        m_operands_functor{m_operands_program, operands_kernel::entry()},
+        m_combine_functor{m_combine_program, combine_kernel::entry()}, m_cutoff{cutoff} {
+    // Leaf products are only parts of the result
+    this->reject_epilogue("Strassen");
+  }
+
+  strassen_matmult(unsigned tile_size, size_type cutoff, bool prefetch = false)
+      : strassen_matmult{tile_size, cutoff, gpu_matmult<T>{}, prefetch} {}
+
+  size_type cutoff() const { return m_cutoff; }
+
+  // Pick the smallest of the sizes for which a single step on square matrices beats the classic kernel, and set the
+  // cutoff right below it
+  size_type tune_cutoff(std::vector<size_type> sizes = {256, 512, 1024, 2048, 4096}) {
+    if (sizes.empty()) throw std::invalid_argument{"No sizes to tune the cutoff on"};
+
+    for (auto size : sizes) {
+      device_matrix<T> mata = {m_ctx, size, size}, matb = {m_ctx, size, size}, matc = {m_ctx, size, size};
+      m_queue.enqueueFillBuffer(mata.buffer(), T{1}, 0, mata.bin_size());
+      m_queue.enqueueFillBuffer(matb.buffer(), T{1}, 0, matb.bin_size());
+
+      const auto measure = [&](size_type cutoff) {
+        m_cutoff = cutoff;
+        cl::Event event = enqueue(mata.buffer(), matb.buffer(), matc.buffer(), {size, size, size});
+        event.wait();
+        return event.getProfilingInfo<CL_PROFILING_COMMAND_END>() -
+               m_first.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+      };
+
+      const auto classic = measure(size), step = measure(size / 2);
+      if (step < classic) return m_cutoff = size / 2;
+    }
+
+    return m_cutoff = sizes.back();
+  }
+};
+
+// Triangle of a symmetric result computed by symmetric_matmult, or the nonzero triangle of A in triangular_matmult
+enum class triangle : unsigned { lower = 0, upper = 1 };
+
+// Products whose result is known to be symmetric, such as A * A^T. Only the tiles of one triangle of C are computed,
+// which takes about half of the multiply-adds and stores of a general product. With mirror every element is stored to
+// its transposed position as well. Otherwise the other triangle of a device C isn't written, and host results have it
+// zeroed. Epilogues can't add a bias, since the result wouldn't be symmetric.
+template <typename T, typename t_name> class symmetric_matmult : public gpu_matmult<T> {
+  using kernel = matmult_syrk_kernel;
+
+public:
+  using typename gpu_matmult<T>::matrix_type;
+  using typename gpu_matmult<T>::device_matrix_type;
+
+private:
+  using gpu_matmult<T>::m_ctx;
+  using gpu_matmult<T>::m_queue;
+  using gpu_matmult<T>::get_profiling_info;
+
+  cl::Program m_program;
+  kernel::functor_type m_functor;
+
+  triangle m_uplo;
+  unsigned m_tile_size;
+  bool m_mirror;
+
+  // C = A * op(B) for N x N matrix C. B is N x ay with trans_b and ay x N otherwise.
+  cl::Event enqueue_symmetric(cl::Buffer bufa, cl::Buffer bufb, cl::Buffer bufc, std::size_t n, std::size_t ay,
+                              bool trans_b) {
+    const std::size_t blocks = (n + m_tile_size - 1) / m_tile_size;
+    // Work-groups are laid out along the first dimension, one per block of the triangle
+    cl::EnqueueArgs args = {
+        m_queue, {blocks * (blocks + 1) / 2 * m_tile_size, m_tile_size}, {m_tile_size, m_tile_size}};
+    return m_functor(args, bufa, bufb, bufc, n, ay, int{trans_b});
+  }
+
+  // The kernel takes no bias argument, so a bias is rejected before the program is built
+  static std::string source(triangle uplo, unsigned tile_size, bool mirror, const epilogue<T> &epi) {
+    if (epi.bias) throw std::invalid_argument{"Symmetric engine can't add a bias to the result"};
+    return kernel::source(t_name::name_str, tile_size, static_cast<unsigned>(uplo), unsigned{mirror}, epi.source());
+  }
+
+  void clear_other_triangle(matrix_type &mat) const {
+    const auto n = mat.rows();
+    for (std::size_t i = 0; i < n; ++i) {
+      auto *row = mat.data() + i * n;
+      if (m_uplo == triangle::lower) std::fill(row + i + 1, row + n, T{});
+      else std::fill(row, row + i, T{});
+    }
+  }
+
+protected:
+  void check_sizes(matrix_sizes sizes) const override {
+    if (sizes.ax != sizes.by) throw std::invalid_argument{"Symmetric product should be square"};
+  }
+
+  cl::Event enqueue(cl::Buffer bufa, cl::Buffer bufb, cl::Buffer bufc, matrix_sizes sizes) override {
+    return enqueue_symmetric(bufa, bufb, bufc, sizes.ax, sizes.ay, false);
+  }
+
+public:
+  symmetric_matmult(triangle uplo, unsigned tile_size, gpu_matmult<T> base, bool mirror = true)
+      : gpu_matmult<T>{base}, m_program{m_ctx, source(uplo, tile_size, mirror, this->m_epilogue), true},
+        m_functor{m_program, kernel::entry()}, m_uplo{uplo}, m_tile_size{tile_size}, m_mirror{mirror} {}
+
+  symmetric_matmult(triangle uplo, unsigned tile_size, bool mirror = true)
+      : symmetric_matmult{uplo, tile_size, gpu_matmult<T>{}, mirror} {}
+
+  triangle uplo() const { return m_uplo; }
+  bool mirrored() const { return m_mirror; }
+
+  // C = A * A^T for a matrix that is already on the device. A is read twice instead of being transposed. Like other
+  // device products, the other triangle of C is left as it was unless the engine mirrors, only host results have it
+  // zeroed.
+  void rank_k(const device_matrix_type &mata, device_matrix_type &matc, profiling_info *time = nullptr) {
+    if (matc.rows() != mata.rows() || matc.cols() != mata.rows())
+      throw std::invalid_argument{"Mismatched matrix sizes"};
+
+    auto wall_start = std::chrono::high_resolution_clock::now();
+    auto event = enqueue_symmetric(mata.buffer(), mata.buffer(), matc.buffer(), mata.rows(), mata.cols(), true);
+    event.wait();
+    auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (time) *time = get_profiling_info(event, wall_start, wall_end);
+  }
+
+  device_matrix_type rank_k(const device_matrix_type &mata, profiling_info *time = nullptr) {
+    device_matrix_type matc = {m_ctx, mata.rows(), mata.rows()};
+    rank_k(mata, matc, time);
+    return matc;
+  }
+
+  matrix_type rank_k(const matrix_type &mata, profiling_info *time = nullptr) {
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    auto bufa = this->upload(mata);
+    device_matrix_type bufc = {m_ctx, mata.rows(), mata.rows()};
+    auto event = enqueue_symmetric(bufa.buffer(), bufa.buffer(), bufc.buffer(), mata.rows(), mata.cols(), true);
+    event.wait();
+    auto matc = this->download(bufc);
+    if (!m_mirror) clear_other_triangle(matc);
+
+    auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (time) *time = get_profiling_info(event, wall_start, wall_end);
+    return matc;
+  }
+
+  matrix_type operator()(const matrix_type &mata, const matrix_type &matb, profiling_info *time = nullptr) override {
+    auto matc = gpu_matmult<T>::operator()(mata, matb, time);
+    if (!m_mirror) clear_other_triangle(matc);
+    return matc;
+  }
+};
+
+// Products C = A * B with a triangular A. Only the tiles of A that have nonzero elements are multiplied, which takes
+// about half of the multiply-adds and loads of a general product. The other triangle of A is never read, so it may
+// hold anything. Products with few columns aren't routed to the GEMV kernel, which would read the whole of A.
+template <typename T, typename t_name> class triangular_matmult : public gpu_matmult<T> {
+  using kernel = matmult_trmm_kernel;
+
+private:
+  using gpu_matmult<T>::m_ctx;
+  using gpu_matmult<T>::m_queue;
+
+  cl::Program m_program;
+  kernel::functor_type m_functor;
+
+  triangle m_uplo;
+  unsigned m_tile_size;
+
+protected:
+  void check_sizes(matrix_sizes sizes) const override {
+    if (sizes.ax != sizes.ay) throw std::invalid_argument{"Triangular matrix should be square"};
+  }
+
+  cl::Event enqueue(cl::Buffer bufa, cl::Buffer bufb, cl::Buffer bufc, matrix_sizes sizes) override {
+    const auto round_up = [tile = m_tile_size](std::size_t sz) { return (sz + tile - 1) / tile * tile; };
+    cl::EnqueueArgs args = {m_queue, {round_up(sizes.ax), round_up(sizes.by)}, {m_tile_size, m_tile_size}};
+    return m_functor(args, bufa, bufb, bufc, sizes.ax, sizes.by, this->bias_argument(bufc, sizes.by));
+  }
+
+public:
+  triangular_matmult(triangle uplo, unsigned tile_size, gpu_matmult<T> base)
+      : gpu_matmult<T>{base},
+        m_program{m_ctx,
+                  kernel::source(t_name::name_str, tile_size, static_cast<unsigned>(uplo), this->m_epilogue.source()),
+                  true},
+        m_functor{m_program, kernel::entry()}, m_uplo{uplo}, m_tile_size{tile_size} {}
+
+  triangular_matmult(triangle uplo, unsigned tile_size) : triangular_matmult{uplo, tile_size, gpu_matmult<T>{}} {}
+
+  triangle uplo() const { return m_uplo; }
+};
+
+} // namespace matmult
@@ -0,0 +1,236 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "matmult.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+#include "kernelhpp/sparse_spmm_kernel.hpp"
+#include "kernelhpp/sparse_spmv_kernel.hpp"
+
+namespace matmult {
+
+// Compressed sparse row matrix: nonzeros of row i are values[row_ptr[i] .. row_ptr[i + 1]) in columns col_idx[...]
+template <typename T> struct csr_matrix {
+  std::size_t rows = 0, cols = 0;
+  std::vector<cl_uint> row_ptr, col_idx;
+  std::vector<T> values;
+
+  std::size_t nnz() const { return values.size(); }
+  std::size_t row_length(std::size_t row) const { return row_ptr[row + 1] - row_ptr[row]; }
+  double density() const { return (rows && cols ? static_cast<double>(nnz()) / rows / cols : 0.0); }
+};
+
+template <typename T> csr_matrix<T> to_csr(const host_matrix<T> &mat) {
+  csr_matrix<T> res = {mat.rows(), mat.cols(), {}, {}, {}};
+  res.row_ptr.reserve(mat.rows() + 1);
+  res.row_ptr.push_back(0);
+
+  for (std::size_t i = 0; i < mat.rows(); ++i) {
+    const T *row = mat.data() + i * mat.cols();
+    for (std::size_t j = 0; j < mat.cols(); ++j) {
+      if (row[j] == T{0}) continue;
+      res.col_idx.push_back(j);
+      res.values.push_back(row[j]);
+    }
+    if (res.values.size() > std::numeric_limits<cl_uint>::max())
+      throw std::out_of_range{"Too many nonzeros for 32-bit CSR indices"};
+    res.row_ptr.push_back(res.values.size());
+  }
+
+  return res;
+}
+
+template <typename T> host_matrix<T> to_dense(const csr_matrix<T> &mat) {
+  host_matrix<T> res = {mat.rows, mat.cols};
+  for (std::size_t i = 0; i < mat.rows; ++i) {
+    T *row = res.data() + i * mat.cols;
+    for (auto k = mat.row_ptr[i]; k < mat.row_ptr[i + 1]; ++k) {
+      row[mat.col_idx[k]] = mat.values[k];
+    }
+  }
+  return res;
+}
+
+// CSR matrix in device buffers. Rows are also grouped by length: short rows are handled by one work-item each and
+// long ones by a whole work-group in SpMV, while SpMM walks rows sorted by length.
+struct device_csr {
+  std::size_t rows = 0, cols = 0, nnz = 0;
+  cl::Buffer row_ptr, col_idx, values;
+  cl::Buffer short_rows, long_rows, sorted_rows;
+  std::size_t short_count = 0, long_count = 0;
+};
+
+// Sparse by dense products on the device. Dense host products go through to_csr, so the engine can be compared with
+// dense ones directly; multiplying by a single column is done by SpMV.
+template <typename T, typename t_name> class sparse_matmult : public gpu_matmult<T> {
+  using spmv_kernel = sparse_spmv_kernel;
+  using spmm_kernel = sparse_spmm_kernel;
+
+public:
+  using typename gpu_matmult<T>::matrix_type;
+  using csr_type = csr_matrix<T>;
+
+  // Rows with at least this many nonzeros are split between the items of a work-group in SpMV
+  static constexpr unsigned c_work_group_size = 64;
+
+private:
+  using gpu_matmult<T>::m_ctx;
+  using gpu_matmult<T>::m_queue;
+  using gpu_matmult<T>::get_profiling_info;
+
+  cl::Program m_spmv_scalar_program, m_spmv_vector_program, m_spmm_program;
+  spmv_kernel::functor_type m_spmv_scalar, m_spmv_vector;
+  spmm_kernel::functor_type m_spmm;
+
+  template <typename t_elem> cl::Buffer make_buffer(const std::vector<t_elem> &vec) {
+    // Zero-sized buffers aren't allowed, empty lists get one unused element
+    cl::Buffer buf = {m_ctx, CL_MEM_READ_ONLY, std::max<std::size_t>(vec.size(), 1) * sizeof(t_elem)};
+    if (!vec.empty()) cl::copy(m_queue, vec.begin(), vec.end(), buf);
+    return buf;
+  }
+
+  void finish(const std::vector<cl::Event> &events, auto wall_start, profiling_info *time) const {
+    for (const auto &event : events) {
+      event.wait();
+    }
+    auto wall_end = std::chrono::high_resolution_clock::now();
+    if (time && !events.empty()) *time = get_profiling_info(events.front(), events.back(), wall_start, wall_end);
+  }
+
+protected:
+  cl::Event enqueue(cl::Buffer, cl::Buffer, cl::Buffer, matrix_sizes) override {
+    throw std::logic_error{"Sparse engine doesn't multiply dense device matrices"};
+  }
+
+public:
+  sparse_matmult(gpu_matmult<T> base)
+      : gpu_matmult<T>{base},
+        m_spmv_scalar_program{m_ctx, spmv_kernel::source(t_name::name_str, 0u, c_work_group_size), true},
+        m_spmv_vector_program{m_ctx, spmv_kernel::source(t_name::name_str, 1u, c_work_group_size), true},
+        m_spmm_program{m_ctx, spmm_kernel::source(t_name::name_str), true},
+        m_spmv_scalar{m_spmv_scalar_program, spmv_kernel::entry()},
+        m_spmv_vector{m_spmv_vector_program, spmv_kernel::entry()}, m_spmm{m_spmm_program, spmm_kernel::entry()} {
+    this->reject_epilogue("Sparse");
+  }
+
+  sparse_matmult() : sparse_matmult{gpu_matmult<T>{}} {}
+
+  device_csr upload(const csr_type &mat) {
+    std::vector<cl_uint> short_rows, long_rows, sorted_rows(mat.rows);
+    for (std::size_t i = 0; i < mat.rows; ++i) {
+      (mat.row_length(i) >= c_work_group_size ? long_rows : short_rows).push_back(i);
+    }
+
+    std::iota(sorted_rows.begin(), sorted_rows.end(), 0);
+    std::stable_sort(sorted_rows.begin(), sorted_rows.end(),
+                     [&mat](auto lhs, auto rhs) { return mat.row_length(lhs) > mat.row_length(rhs); });
+
+    return device_csr{mat.rows,
+                      mat.cols,
+                      mat.nnz(),
+                      make_buffer(mat.row_ptr),
+                      make_buffer(mat.col_idx),
+                      make_buffer(mat.values),
+                      make_buffer(short_rows),
+                      make_buffer(long_rows),
+                      make_buffer(sorted_rows),
+                      short_rows.size(),
+                      long_rows.size()};
+  }
+
+  // y = A * x for a vector in a device buffer
+  std::vector<cl::Event> enqueue_spmv(const device_csr &mat, cl::Buffer x, cl::Buffer y) {
+    std::vector<cl::Event> events;
+    if (mat.short_count) {
+      cl::EnqueueArgs args = {m_queue, cl::NDRange{mat.short_count}};
+      events.push_back(m_spmv_scalar(args, mat.row_ptr, mat.col_idx, mat.values, x, y, mat.short_rows,
+                                     static_cast<int>(mat.short_count)));
+    }
+    if (mat.long_count) {
+      cl::EnqueueArgs args = {m_queue, cl::NDRange{mat.long_count * c_work_group_size}, cl::NDRange{c_work_group_size}};
+      events.push_back(m_spmv_vector(args, mat.row_ptr, mat.col_idx, mat.values, x, y, mat.long_rows,
+                                     static_cast<int>(mat.long_count)));
+    }
+    return events;
+  }
+
+  // C = A * B for a row-major matrix with by columns in a device buffer
+  cl::Event enqueue_spmm(const device_csr &mat, cl::Buffer bufb, cl::Buffer bufc, std::size_t by) {
+    cl::EnqueueArgs args = {m_queue, cl::NDRange{by, mat.rows}};
+    return m_spmm(args, mat.row_ptr, mat.col_idx, mat.values, bufb, bufc, mat.sorted_rows, static_cast<int>(mat.rows),
+                  static_cast<int>(by));
+  }
+
+  std::vector<T> spmv(const csr_type &mat, const std::vector<T> &x, profiling_info *time = nullptr) {
+    if (x.size() != mat.cols) throw std::invalid_argument{"Mismatched matrix and vector sizes"};
+    if (!mat.rows) return {};
+
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    auto dev = upload(mat);
+    auto bufx = make_buffer(x);
+    cl::Buffer bufy = {m_ctx, CL_MEM_WRITE_ONLY, mat.rows * sizeof(T)};
+
+    const auto events = enqueue_spmv(dev, bufx, bufy);
+    std::vector<T> y(mat.rows);
+    cl::copy(m_queue, bufy, y.begin(), y.end());
+
+    finish(events, wall_start, time);
+    return y;
+  }
+
+  matrix_type spmm(const csr_type &mat, const matrix_type &matb, profiling_info *time = nullptr) {
+    if (mat.cols != matb.rows()) throw std::invalid_argument{"Mismatched matrix sizes"};
+    // An NDRange can't have a zero dimension, and an empty A or B gives a zero product
+    if (!mat.rows || !mat.cols || !matb.cols()) return matrix_type{mat.rows, matb.cols()};
+
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    auto dev = upload(mat);
+    auto bufb = gpu_matmult<T>::upload(matb);
+    device_matrix<T> bufc = {m_ctx, mat.rows, matb.cols()};
+
+    const auto event = enqueue_spmm(dev, bufb.buffer(), bufc.buffer(), matb.cols());
+    auto matc = gpu_matmult<T>::download(bufc);
+
+    finish({event}, wall_start, time);
+    return matc;
+  }
+
+  // Dense inputs are converted to CSR on every product, so the conversion counts towards the wall time
+  matrix_type operator()(const matrix_type &mata, const matrix_type &matb, profiling_info *time = nullptr) override {
+    auto wall_start = std::chrono::high_resolution_clock::now();
+    const auto csr = to_csr(mata);
+
+    matrix_type matc;
+    if (matb.cols() != 1) {
+      matc = spmm(csr, matb, time);
+    } else {
+      matc = matrix_type{mata.rows(), 1};
+      const auto y = spmv(csr, std::vector<T>(matb.begin(), matb.end()), time);
+      std::copy(y.begin(), y.end(), matc.begin());
+    }
+
+    auto wall_end = std::chrono::high_resolution_clock::now();
+    if (time) time->wall = std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start);
+    return matc;
+  }
+};
+
+} // namespace matmult
@@ -1,9 +1,9 @@
 /* Simplest possible bitonic sort using only global memory. Note: SEGMENT_SIZE should be a power of 2
- * (obviously)
+ * (obviously). INDEX_TYPE is used to address the global buffer and is either uint or ulong
  *
  *  @kernel    ( {"name" : "bitonic_local_initial_kernel", "entry" : "local_initial"} )
  *  @signature ( ["cl::Buffer", "unsigned", "unsigned", "unsigned"] )
- *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "unsigned", "name": "SEGMENT_SIZE"}] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "unsigned", "name": "SEGMENT_SIZE"}, {"type" : "std::string", "name": "INDEX_TYPE"}] )
  *
  */
 
@@ -18,14 +18,14 @@
 #define LOCAL_THREADS HALF_SEGMENT_SIZE
 
 __kernel void local_initial(__global TYPE *buf, uint stage_start, uint stage_end, uint step_offset) {
-  uint gid = get_global_id(0);
+  INDEX_TYPE gid = get_global_id(0);
   uint lid = get_local_id(0);
-  uint sid = (gid / HALF_SEGMENT_SIZE);
+  INDEX_TYPE sid = (gid / HALF_SEGMENT_SIZE);
 
   uint local_first_load_id = lid, local_second_load_id = SEGMENT_SIZE - lid - 1;
 
-  uint first_data_load_id = sid * SEGMENT_SIZE + lid;
-  uint second_data_load_id = sid * SEGMENT_SIZE + SEGMENT_SIZE - 1 - lid;
+  INDEX_TYPE first_data_load_id = sid * SEGMENT_SIZE + lid;
+  INDEX_TYPE second_data_load_id = sid * SEGMENT_SIZE + SEGMENT_SIZE - 1 - lid;
 
   __local TYPE segment[SEGMENT_SIZE];
   segment[local_first_load_id] = buf[first_data_load_id];
@@ -0,0 +1,125 @@
+/* Same network as local_initial, but each work-item owns ELEMS consecutive elements of the segment. Strides shorter
+ * than ELEMS are done in private registers with fully unrolled compare-exchanges and the rest go through local memory,
+ * so the first log2(ELEMS) stages and the tail of every other stage need no barriers. Supported ELEMS are 4, 8 and 16.
+ *
+ *  @kernel    ( {"name" : "bitonic_local_register_kernel", "entry" : "local_register"} )
+ *  @signature ( ["cl::Buffer", "unsigned", "unsigned", "unsigned"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "unsigned", "name": "SEGMENT_SIZE"}, {"type" : "std::string", "name": "INDEX_TYPE"}, {"type" : "unsigned", "name": "ELEMS"}] )
+ *
+ */
+
+#define SORT2(a, b)                                                                                                    \
+  if (a > b) {                                                                                                         \
+    TYPE temp = a;                                                                                                     \
+    a = b;                                                                                                             \
+    b = temp;                                                                                                          \
+  }
+
+#define LOG_ELEMS (ELEMS == 4 ? 2 : (ELEMS == 8 ? 3 : 4))
+#define LOCAL_THREADS (SEGMENT_SIZE / ELEMS)
+
+// Steps [first_step, 0] of a stage for elements held by a single work-item. Loops are unrolled, so all indices into
+// regs are compile-time constants and the array stays in registers.
+void register_steps(TYPE *regs, uint stage, int first_step) {
+#pragma unroll
+  for (int step = LOG_ELEMS - 1; step >= 0; --step) {
+    if (step > first_step) continue;
+    const uint half_length = 1 << step;
+
+    if (stage == step) { // The first step in a stage
+#pragma unroll
+      for (uint a = 0; a < ELEMS; ++a) {
+        if (a & half_length) continue;
+        SORT2(regs[a], regs[a ^ (2 * half_length - 1)]);
+      }
+    } else {
+#pragma unroll
+      for (uint a = 0; a < ELEMS; ++a) {
+        if (a & half_length) continue;
+        SORT2(regs[a], regs[a + half_length]);
+      }
+    }
+  }
+}
+
+__kernel void local_register(__global TYPE *buf, uint stage_start, uint stage_end, uint step_offset) {
+  INDEX_TYPE gid = get_global_id(0);
+  uint lid = get_local_id(0);
+  INDEX_TYPE segment_offset = (gid / LOCAL_THREADS) * SEGMENT_SIZE;
+
+  // Coalesced load, consecutive work-items read consecutive elements
+  __local TYPE segment[SEGMENT_SIZE];
+#pragma unroll
+  for (uint t = 0; t < ELEMS; ++t) {
+    segment[t * LOCAL_THREADS + lid] = buf[segment_offset + t * LOCAL_THREADS + lid];
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  const uint chunk_offset = lid * ELEMS;
+  TYPE regs[ELEMS];
+  bool in_registers = false;
+
+  for (uint stage = stage_start; stage < stage_end; ++stage) {
+    int step = stage - step_offset;
+
+    // Long strides: every work-item handles ELEMS / 2 pairs in local memory
+    for (; step >= LOG_ELEMS; --step) {
+      if (in_registers) {
+#pragma unroll
+        for (uint t = 0; t < ELEMS; ++t) {
+          segment[chunk_offset + t] = regs[t];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        in_registers = false;
+      }
+
+      const uint half_length = 1 << step, part_length = half_length * 2;
+
+#pragma unroll
+      for (uint t = 0; t < ELEMS / 2; ++t) {
+        const uint pair_index = t * LOCAL_THREADS + lid;
+        const uint part_index = pair_index >> step;
+
+        const uint i = pair_index - part_index * half_length;
+        uint j;
+
+        if (stage == step) { // The first step in a stage
+          j = part_length - i - 1;
+        } else {
+          j = i + half_length;
+        }
+
+        const uint offset = part_index * part_length;
+        SORT2(segment[offset + i], segment[offset + j]);
+      }
+
+      barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (step < 0) continue;
+
+    // Short strides: both elements of every pair belong to the chunk of this work-item
+    if (!in_registers) {
+#pragma unroll
+      for (uint t = 0; t < ELEMS; ++t) {
+        regs[t] = segment[chunk_offset + t];
+      }
+      in_registers = true;
+    }
+
+    register_steps(regs, stage, step);
+  }
+
+  if (in_registers) {
+#pragma unroll
+    for (uint t = 0; t < ELEMS; ++t) {
+      segment[chunk_offset + t] = regs[t];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+#pragma unroll
+  for (uint t = 0; t < ELEMS; ++t) {
+    buf[segment_offset + t * LOCAL_THREADS + lid] = segment[t * LOCAL_THREADS + lid];
+  }
+}
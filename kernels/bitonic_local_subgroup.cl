@@ -0,0 +1,121 @@
+/* Same network as local_initial, but steps with short strides are done in registers with sub-group shuffles, so they
+ * need neither local memory nor barriers. Work-item number v of the work-group holds elements 2v and 2v + 1 of the
+ * segment while in registers. Sub-group size is assumed to be a power of 2. Set INTEL_SUBGROUPS to 1 to use
+ * cl_intel_subgroups instead of cl_khr_subgroups + cl_khr_subgroup_shuffle.
+ *
+ *  @kernel    ( {"name" : "bitonic_local_subgroup_kernel", "entry" : "local_subgroup"} )
+ *  @signature ( ["cl::Buffer", "unsigned", "unsigned", "unsigned"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "unsigned", "name": "SEGMENT_SIZE"}, {"type" : "std::string", "name": "INDEX_TYPE"}, {"type" : "unsigned", "name": "INTEL_SUBGROUPS"}] )
+ *
+ */
+
+#if INTEL_SUBGROUPS
+#pragma OPENCL EXTENSION cl_intel_subgroups : enable
+#define SHUFFLE_XOR intel_sub_group_shuffle_xor
+#else
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#pragma OPENCL EXTENSION cl_khr_subgroup_shuffle : enable
+#define SHUFFLE_XOR sub_group_shuffle_xor
+#endif
+
+#define SORT2(a, b)                                                                                                    \
+  if (a > b) {                                                                                                         \
+    TYPE temp = a;                                                                                                     \
+    a = b;                                                                                                             \
+    b = temp;                                                                                                          \
+  }
+
+#define KEEP(keep_min, value, other)                                                                                   \
+  ((keep_min) ? ((other) < (value) ? (other) : (value)) : ((other) > (value) ? (other) : (value)))
+
+#define HALF_SEGMENT_SIZE (SEGMENT_SIZE / 2)
+
+__kernel void local_subgroup(__global TYPE *buf, uint stage_start, uint stage_end, uint step_offset) {
+  INDEX_TYPE gid = get_global_id(0);
+  uint lid = get_local_id(0);
+  INDEX_TYPE sid = (gid / HALF_SEGMENT_SIZE);
+
+  uint local_first_load_id = lid, local_second_load_id = SEGMENT_SIZE - lid - 1;
+
+  INDEX_TYPE first_data_load_id = sid * SEGMENT_SIZE + lid;
+  INDEX_TYPE second_data_load_id = sid * SEGMENT_SIZE + SEGMENT_SIZE - 1 - lid;
+
+  __local TYPE segment[SEGMENT_SIZE];
+  segment[local_first_load_id] = buf[first_data_load_id];
+  segment[local_second_load_id] = buf[second_data_load_id];
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  // Position of the work-item in terms of sub-groups, so that lanes of one sub-group hold adjacent elements
+  const uint sub_group_size = get_sub_group_size();
+  const uint vid = get_sub_group_id() * get_max_sub_group_size() + get_sub_group_local_id();
+  const uint first_register_id = 2 * vid, second_register_id = 2 * vid + 1;
+
+  TYPE first = 0, second = 0;
+  bool in_registers = false;
+
+  for (uint stage = stage_start; stage < stage_end; ++stage) {
+    for (int step = stage - step_offset; step >= 0; --step) {
+      const uint half_length = 1 << step, part_length = half_length * 2;
+
+      // Partner element lives in the same sub-group, exchange through registers
+      if (half_length <= sub_group_size) {
+        if (!in_registers) {
+          first = segment[first_register_id];
+          second = segment[second_register_id];
+          in_registers = true;
+        }
+
+        if (step == 0) { // Both elements of the pair belong to this work-item
+          SORT2(first, second);
+          continue;
+        }
+
+        const bool flip = (stage == step);
+        const uint lane_mask = (flip ? half_length - 1 : half_length / 2);
+
+        // The first step in a stage pairs element i with part_length - i - 1 which belongs to the other register
+        const TYPE first_partner = SHUFFLE_XOR(flip ? second : first, lane_mask);
+        const TYPE second_partner = SHUFFLE_XOR(flip ? first : second, lane_mask);
+
+        // Both elements are in the same half of the part, the lower half keeps the minimum
+        const bool keep_min = ((first_register_id & half_length) == 0);
+        first = KEEP(keep_min, first, first_partner);
+        second = KEEP(keep_min, second, second_partner);
+        continue;
+      }
+
+      if (in_registers) {
+        segment[first_register_id] = first;
+        segment[second_register_id] = second;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        in_registers = false;
+      }
+
+      const uint part_index = lid >> step;
+
+      const uint i = lid - part_index * half_length;
+      uint j;
+
+      if (stage == step) { // The first step in a stage
+        j = part_length - i - 1;
+      } else {
+        j = i + half_length;
+      }
+
+      const uint offset = part_index * part_length;
+      const uint first_index = offset + i, second_index = offset + j;
+
+      SORT2(segment[first_index], segment[second_index]);
+      barrier(CLK_LOCAL_MEM_FENCE);
+    }
+  }
+
+  if (in_registers) {
+    buf[sid * SEGMENT_SIZE + first_register_id] = first;
+    buf[sid * SEGMENT_SIZE + second_register_id] = second;
+    return;
+  }
+
+  buf[first_data_load_id] = segment[local_first_load_id];
+  buf[second_data_load_id] = segment[local_second_load_id];
+}
@@ -0,0 +1,50 @@
+/* Merge two sorted sequences. Each element finds its final position with a binary search in the other sequence, so
+ * sizes don't have to be powers of 2. Equal elements from the first sequence go first, which keeps the merge stable.
+ * INDEX_TYPE is uint or ulong depending on the total length, and so are the sizes of the sequences.
+ *
+ *  @kernel    ( {"name" : "bitonic_merge_sorted_kernel", "entry" : "merge_sorted"} )
+ *  @signature ( ["cl::Buffer", "INDEX_TYPE", "cl::Buffer", "INDEX_TYPE", "cl::Buffer"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "std::string", "name": "INDEX_TYPE"}] )
+ *
+ */
+
+__kernel void merge_sorted(__global TYPE *first, INDEX_TYPE first_size, __global TYPE *second,
+                           INDEX_TYPE second_size, __global TYPE *dst) {
+  INDEX_TYPE gid = get_global_id(0);
+  if (gid >= first_size + second_size) return;
+
+  INDEX_TYPE low = 0, high;
+
+  if (gid < first_size) { // Count elements of the second sequence that are strictly less
+    const TYPE value = first[gid];
+    high = second_size;
+
+    while (low < high) {
+      const INDEX_TYPE middle = low + (high - low) / 2;
+      if (second[middle] < value) {
+        low = middle + 1;
+      } else {
+        high = middle;
+      }
+    }
+
+    dst[gid + low] = value;
+    return;
+  }
+
+  // Count elements of the first sequence that are less or equal
+  const INDEX_TYPE index = gid - first_size;
+  const TYPE value = second[index];
+  high = first_size;
+
+  while (low < high) {
+    const INDEX_TYPE middle = low + (high - low) / 2;
+    if (first[middle] <= value) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  dst[index + low] = value;
+}
@@ -1,8 +1,9 @@
-/* Simplest possible bitonic sort using only global memory
+/* Simplest possible bitonic sort using only global memory. INDEX_TYPE is uint, unless the sequence is longer than
+ * 2^32 - 1, then it's ulong
  *
  *  @kernel    ( {"name" : "bitonic_naive_kernel", "entry" : "naive_bitonic"} )
  *  @signature ( ["cl::Buffer", "unsigned", "unsigned"] )
- *  @macros    ( [{"type" : "std::string", "name": "TYPE"}] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "std::string", "name": "INDEX_TYPE"}] )
  *
  */
 
@@ -14,13 +15,13 @@
   }
 
 __kernel void naive_bitonic(__global TYPE *buf, uint stage, uint step) {
-  uint gid = get_global_id(0);
+  INDEX_TYPE gid = get_global_id(0);
 
-  const uint half_length = 1 << step, part_length = half_length * 2;
-  const uint part_index = gid >> step;
+  const INDEX_TYPE half_length = (INDEX_TYPE)1 << step, part_length = half_length * 2;
+  const INDEX_TYPE part_index = gid >> step;
 
-  const uint i = gid - part_index * half_length;
-  uint j;
+  const INDEX_TYPE i = gid - part_index * half_length;
+  INDEX_TYPE j;
 
   if (stage == step) { // The first step in a stage
     j = part_length - i - 1;
@@ -28,8 +29,8 @@ __kernel void naive_bitonic(__global TYPE *buf, uint stage, uint step) {
     j = i + half_length;
   }
 
-  const uint offset = part_index * part_length;
-  const uint first_index = offset + i, second_index = offset + j;
+  const INDEX_TYPE offset = part_index * part_length;
+  const INDEX_TYPE first_index = offset + i, second_index = offset + j;
 
   SORT2(buf[first_index], buf[second_index]);
 }
\ No newline at end of file
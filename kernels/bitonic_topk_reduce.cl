@@ -0,0 +1,19 @@
+/* Keep the best half of each pair of adjacent sorted runs. For ascending runs A and B of length n the n best elements
+ * are SELECT(A[i], B[n - 1 - i]), which is a bitonic sequence and can be sorted with a single bitonic merge. SELECT is
+ * either min or max. INDEX_TYPE is uint or ulong depending on the length of the sequence, and so is run_length.
+ *
+ *  @kernel    ( {"name" : "bitonic_topk_reduce_kernel", "entry" : "topk_reduce"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "INDEX_TYPE"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "std::string", "name": "SELECT"}, {"type" : "std::string", "name": "INDEX_TYPE"}] )
+ *
+ */
+
+__kernel void topk_reduce(__global TYPE *src, __global TYPE *dst, INDEX_TYPE run_length) {
+  INDEX_TYPE gid = get_global_id(0);
+
+  const INDEX_TYPE pair_index = gid / run_length;
+  const INDEX_TYPE i = gid - pair_index * run_length;
+  const INDEX_TYPE offset = 2 * pair_index * run_length;
+
+  dst[gid] = SELECT(src[offset + i], src[offset + 2 * run_length - 1 - i]);
+}
@@ -0,0 +1,28 @@
+/* Expansion of a batch of NCHW images into the columns of a matrix, so that a 2D convolution becomes a matrix product.
+ * Row c * R * S + r * S + s of the result holds, for every output pixel of every image, the input element under tap
+ * (r, s) of the filter in channel c. Column n * P * Q + p * Q + q belongs to pixel (p, q) of image n. Taps that fall
+ * into the padding are zero. Dimension 0 runs along the columns, so writes of neighbouring work-items are coalesced.
+ *
+ *  @kernel    ( {"name" : "conv_im2col_kernel", "entry" : "im2col"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "int", "int", "int", "int", "int", "int", "int", "int", "int", "int"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}] )
+ *
+ */
+
+__kernel void im2col(__global const TYPE *input, __global TYPE *cols, int N, int C, int H, int W, int R, int S, int P,
+                     int Q, int stride, int padding) {
+  const int column = get_global_id(0);
+  const int row = get_global_id(1);
+
+  const int n = column / (P * Q), pixel = column % (P * Q);
+  const int p = pixel / Q, q = pixel % Q;
+
+  const int c = row / (R * S), tap = row % (R * S);
+  const int r = tap / S, s = tap % S;
+
+  const int y = p * stride - padding + r;
+  const int x = q * stride - padding + s;
+  const int inside = (y >= 0 && y < H && x >= 0 && x < W);
+
+  cols[(ulong)row * N * P * Q + column] = (inside ? input[(((ulong)n * C + c) * H + y) * W + x] : 0);
+}
@@ -0,0 +1,54 @@
+/* Matrix by vector and matrix by skinny matrix product, C = A * B, where B has BY <= MAX_COLS columns. Each work-group
+ * of WORK_GROUP_SIZE items (a power of two) computes one row of C: items walk the row of A with a stride of the
+ * group size, so consecutive items load consecutive elements, keep partial sums for every column of B in registers
+ * and reduce them in local memory at the end. EPILOGUE is applied to every element of C before it's stored.
+ *
+ *  @kernel    ( {"name" : "matmult_gemv_kernel", "entry" : "gemv"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "cl::Buffer", "int", "int", "int", "cl::Buffer"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type": "unsigned", "name": "WORK_GROUP_SIZE"}, {"type": "unsigned", "name": "MAX_COLS"}, {"type": "std::string", "name": "EPILOGUE"}] )
+ *
+ */
+
+__kernel void gemv(__global const TYPE *A, __global const TYPE *B, __global TYPE *C, int AX, int AY, int BY,
+                   __global const TYPE *bias) {
+  __local TYPE partial[MAX_COLS * WORK_GROUP_SIZE];
+
+  const int row = get_group_id(0);
+  const int lid = get_local_id(0);
+
+  TYPE acc[MAX_COLS];
+  for (int c = 0; c < MAX_COLS; ++c) {
+    acc[c] = 0;
+  }
+
+  __global const TYPE *a_row = A + (ulong)row * AY;
+  for (int k = lid; k < AY; k += WORK_GROUP_SIZE) {
+    const TYPE a = a_row[k];
+    __global const TYPE *b_row = B + (ulong)k * BY;
+    for (int c = 0; c < MAX_COLS; ++c) {
+      if (c < BY) acc[c] += a * b_row[c];
+    }
+  }
+
+  for (int c = 0; c < MAX_COLS; ++c) {
+    partial[c * WORK_GROUP_SIZE + lid] = acc[c];
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (int stride = WORK_GROUP_SIZE / 2; stride > 0; stride /= 2) {
+    if (lid < stride) {
+      for (int c = 0; c < BY; ++c) {
+        partial[c * WORK_GROUP_SIZE + lid] += partial[c * WORK_GROUP_SIZE + lid + stride];
+      }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if (lid >= BY) return;
+
+  const int col = lid;
+  TYPE result = partial[lid * WORK_GROUP_SIZE];
+  EPILOGUE;
+
+  C[(ulong)row * BY + lid] = result;
+}
@@ -0,0 +1,68 @@
+/* Tiled matrix multiplication with A and B stored in reduced precision and C accumulated in a wider type. FORMAT picks
+ * the storage:
+ *   0 - half, read through vload_half, accumulated in float
+ *   1 - bfloat16 kept in ushort, which is the upper half of a float, accumulated in float
+ *   2 - char, accumulated in int
+ * Tiles are widened once when they are loaded to local memory, so global memory traffic for A and B is halved or
+ * quartered compared to float and int kernels.
+ *
+ *  @kernel    ( {"name" : "matmult_mixed_kernel", "entry" : "mixed"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "cl::Buffer", "int", "int", "int", "int"] )
+ *  @macros    ( [{"type": "unsigned", "name": "TILE_SIZE"}, {"type": "unsigned", "name": "FORMAT"}] )
+ *
+ */
+
+#if FORMAT == 0
+#define STORAGE half
+#define ACCUM float
+#define LOAD(ptr, index) vload_half((index), (ptr))
+#elif FORMAT == 1
+#define STORAGE ushort
+#define ACCUM float
+#define LOAD(ptr, index) as_float((uint)(ptr)[index] << 16)
+#else
+#define STORAGE char
+#define ACCUM int
+#define LOAD(ptr, index) ((int)(ptr)[index])
+#endif
+
+__kernel void mixed(__global const STORAGE *A, __global const STORAGE *B, __global ACCUM *C, int AX, int AY, int BY,
+                    int tile_count) {
+  int tile_row = get_group_id(0);
+  int tile_col = get_group_id(1);
+
+  int local_row = get_local_id(0);
+  int local_col = get_local_id(1);
+
+  __local ACCUM tile_A[TILE_SIZE * TILE_SIZE];
+  __local ACCUM tile_B[TILE_SIZE * TILE_SIZE];
+
+  int global_row = TILE_SIZE * tile_row + local_row;
+  int global_col = TILE_SIZE * tile_col + local_col;
+
+  int row_out_of_bounds = (global_row >= AX);
+  int col_out_of_bounds = (global_col >= BY);
+
+  ACCUM sum = 0;
+
+  for (int t = 0; t < tile_count; ++t) {
+    int curr_tiled_col = t * TILE_SIZE + local_col;
+    int curr_tiled_row = t * TILE_SIZE + local_row;
+
+    tile_A[local_row * TILE_SIZE + local_col] =
+        ((curr_tiled_col >= AY || row_out_of_bounds) ? 0 : LOAD(A, (ulong)global_row * AY + curr_tiled_col));
+    tile_B[local_row * TILE_SIZE + local_col] =
+        ((curr_tiled_row >= AY || col_out_of_bounds) ? 0 : LOAD(B, (ulong)curr_tiled_row * BY + global_col));
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int k = 0; k < TILE_SIZE; ++k) {
+      sum += tile_A[TILE_SIZE * local_row + k] * tile_B[k * TILE_SIZE + local_col];
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if (row_out_of_bounds || col_out_of_bounds) return;
+  C[(ulong)global_row * BY + global_col] = sum;
+}
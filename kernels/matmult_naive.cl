@@ -1,12 +1,14 @@
-/* Simplest possible matrix multiplication algorithm without local memory
+/* Simplest possible matrix multiplication algorithm without local memory. EPILOGUE is applied to every element of C
+ * before it's stored, see matmult::epilogue.
  *
  *  @kernel    ( {"name" : "matmult_naive_kernel", "entry" : "naive"} )
- *  @signature ( ["cl::Buffer", "cl::Buffer", "cl::Buffer", "int", "int", "int"] )
- *  @macros    ( [{"type" : "std::string", "name": "TYPE"}] )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "cl::Buffer", "int", "int", "int", "cl::Buffer"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type": "std::string", "name": "EPILOGUE"}] )
  *
  */
 
-__kernel void naive(__global TYPE *A, __global TYPE *B, __global TYPE *C, int AX, int AY, int BY) {
+__kernel void naive(__global TYPE *A, __global TYPE *B, __global TYPE *C, int AX, int AY, int BY,
+                    __global const TYPE *bias) {
   int i = get_global_id(0);
   int j = get_global_id(1);
 
@@ -15,5 +17,9 @@ __kernel void naive(__global TYPE *A, __global TYPE *B, __global TYPE *C, int AX
     sum += A[i * AY + k] * B[k * BY + j];
   }
 
-  C[i * BY + j] = sum;
+  const int col = j;
+  TYPE result = sum;
+  EPILOGUE;
+
+  C[i * BY + j] = result;
 }
\ No newline at end of file
@@ -0,0 +1,84 @@
+/* Register-blocked matrix multiplication. A work-group computes a TILE x TILE block of C, each work-item accumulates a
+ * WPT x WPT micro-tile of it in registers. Tiles of A and B are TILE_K deep and are loaded with WPT-wide vector loads.
+ * A is stored transposed in local memory, so that a column of the micro-tile is a contiguous vector as well. Every
+ * step then does 2 * WPT local reads for WPT * WPT multiply-adds instead of 2 reads per multiply-add in "tiled".
+ *
+ * Requirements: WPT is 4 or 8 and divides TILE and TILE_K, AX and BY are multiples of TILE, AY is a multiple of TILE_K.
+ * The work-group is (TILE / WPT) x (TILE / WPT) work-items. EPILOGUE is applied to every element of C before it's stored.
+ *
+ *  @kernel    ( {"name" : "matmult_regblocked_kernel", "entry" : "regblocked"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "cl::Buffer", "int", "int", "int", "cl::Buffer"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type": "unsigned", "name": "TILE"}, {"type": "unsigned", "name": "TILE_K"}, {"type": "unsigned", "name": "WPT"}, {"type": "std::string", "name": "EPILOGUE"}] )
+ *
+ */
+
+#define CAT0(a, b) a##b
+#define CAT(a, b) CAT0(a, b)
+
+#define VECTOR_TYPE CAT(TYPE, WPT)
+#define VLOAD CAT(vload, WPT)
+#define VSTORE CAT(vstore, WPT)
+
+#define THREADS (TILE / WPT)
+
+__kernel __attribute__((reqd_work_group_size(THREADS, THREADS, 1))) void
+regblocked(__global const TYPE *A, __global const TYPE *B, __global TYPE *C, int AX, int AY, int BY,
+           __global const TYPE *bias) {
+  const int local_row = get_local_id(0);
+  const int local_col = get_local_id(1);
+  const int local_id = local_row * THREADS + local_col;
+
+  const int tile_row = get_group_id(0) * TILE;
+  const int tile_col = get_group_id(1) * TILE;
+
+  __local TYPE tile_A[TILE_K * TILE]; // tile_A[k * TILE + row]
+  __local TYPE tile_B[TILE_K * TILE]; // tile_B[k * TILE + col]
+
+  VECTOR_TYPE acc[WPT];
+  for (int i = 0; i < WPT; ++i) {
+    acc[i] = (VECTOR_TYPE)(0);
+  }
+
+  TYPE a_reg[WPT];
+
+  for (int t = 0; t < AY; t += TILE_K) {
+    // Step 1. Cooperatively load TILE x TILE_K block of A and TILE_K x TILE block of B with vector loads
+    for (int v = local_id; v < TILE * TILE_K / WPT; v += THREADS * THREADS) {
+      const int a_row = v / (TILE_K / WPT), a_k = (v % (TILE_K / WPT)) * WPT;
+      TYPE a_vec[WPT];
+      VSTORE(VLOAD(0, A + (tile_row + a_row) * AY + t + a_k), 0, a_vec);
+      for (int i = 0; i < WPT; ++i) {
+        tile_A[(a_k + i) * TILE + a_row] = a_vec[i];
+      }
+
+      const int b_k = v / (TILE / WPT), b_col = (v % (TILE / WPT)) * WPT;
+      VSTORE(VLOAD(0, B + (t + b_k) * BY + tile_col + b_col), 0, tile_B + b_k * TILE + b_col);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Step 2. Outer products of a column of A and a row of B, accumulated in registers
+    for (int k = 0; k < TILE_K; ++k) {
+      VSTORE(VLOAD(0, tile_A + k * TILE + local_row * WPT), 0, a_reg);
+      const VECTOR_TYPE b_vec = VLOAD(0, tile_B + k * TILE + local_col * WPT);
+
+      for (int i = 0; i < WPT; ++i) {
+        acc[i] += a_reg[i] * b_vec;
+      }
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  for (int i = 0; i < WPT; ++i) {
+    TYPE values[WPT];
+    VSTORE(acc[i], 0, values);
+    for (int j = 0; j < WPT; ++j) {
+      const int col = tile_col + local_col * WPT + j;
+      TYPE result = values[j];
+      EPILOGUE;
+      values[j] = result;
+    }
+    VSTORE(VLOAD(0, values), 0, C + (tile_row + local_row * WPT + i) * BY + tile_col + local_col * WPT);
+  }
+}
@@ -0,0 +1,34 @@
+/* Last step of Strassen-Winograd. P holds seven rows x cols products one after another, C is split into four
+ * rows x cols quadrants starting at offset with ld elements between rows:
+ *   C11 = P1 + P2, C12 = U4 + P3, C21 = U3 - P4, C22 = U3 + P5
+ * where U2 = P1 + P6, U3 = U2 + P7 and U4 = U2 + P5. All seven additions are done in one pass.
+ *
+ *  @kernel    ( {"name" : "matmult_strassen_combine_kernel", "entry" : "strassen_combine"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "cl_ulong", "cl_ulong", "int", "int"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}] )
+ *
+ */
+
+__kernel void strassen_combine(__global const TYPE *P, __global TYPE *C, ulong ld, ulong offset, int rows, int cols) {
+  const int row = get_global_id(0);
+  const int col = get_global_id(1);
+  if (row >= rows || col >= cols) return;
+
+  const ulong slice = (ulong)rows * cols;
+  P += (ulong)row * cols + col;
+
+  const TYPE p1 = P[0], p2 = P[slice], p3 = P[2 * slice], p4 = P[3 * slice];
+  const TYPE p5 = P[4 * slice], p6 = P[5 * slice], p7 = P[6 * slice];
+
+  const TYPE u2 = p1 + p6;
+  const TYPE u3 = u2 + p7;
+  const TYPE u4 = u2 + p5;
+
+  __global TYPE *top = C + offset + row * ld;
+  __global TYPE *bottom = top + rows * ld;
+
+  top[col] = p1 + p2;
+  top[cols + col] = u4 + p3;
+  bottom[col] = u3 - p4;
+  bottom[cols + col] = u3 + p5;
+}
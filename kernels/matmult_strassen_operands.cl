@@ -0,0 +1,46 @@
+/* Operands of one Strassen-Winograd step. X is split into four rows x cols quadrants starting at offset with ld
+ * elements between rows. Four rows x cols results are written one after another into out. For A (of_b == 0):
+ *   S1 = X21 + X22, S2 = S1 - X11, S3 = X11 - X21, S4 = X12 - S2
+ * and for B (of_b != 0):
+ *   T1 = X12 - X11, T2 = X22 - T1, T3 = X22 - X12, T4 = T2 - X21
+ * Each quadrant is read once, so all eight additions of a step take two passes over memory instead of eight.
+ *
+ *  @kernel    ( {"name" : "matmult_strassen_operands_kernel", "entry" : "strassen_operands"} )
+ *  @signature ( ["cl::Buffer", "cl_ulong", "cl_ulong", "cl::Buffer", "int", "int", "int"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}] )
+ *
+ */
+
+__kernel void strassen_operands(__global const TYPE *X, ulong ld, ulong offset, __global TYPE *out, int rows, int cols,
+                                int of_b) {
+  const int row = get_global_id(0);
+  const int col = get_global_id(1);
+  if (row >= rows || col >= cols) return;
+
+  __global const TYPE *top = X + offset + row * ld;
+  __global const TYPE *bottom = top + rows * ld;
+
+  const TYPE x11 = top[col], x12 = top[cols + col];
+  const TYPE x21 = bottom[col], x22 = bottom[cols + col];
+
+  TYPE r1, r2, r3, r4;
+  if (of_b) {
+    r1 = x12 - x11;
+    r2 = x22 - r1;
+    r3 = x22 - x12;
+    r4 = r2 - x21;
+  } else {
+    r1 = x21 + x22;
+    r2 = r1 - x11;
+    r3 = x11 - x21;
+    r4 = x12 - r2;
+  }
+
+  const ulong slice = (ulong)rows * cols;
+  const ulong index = (ulong)row * cols + col;
+
+  out[index] = r1;
+  out[slice + index] = r2;
+  out[2 * slice + index] = r3;
+  out[3 * slice + index] = r4;
+}
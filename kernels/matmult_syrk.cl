@@ -0,0 +1,80 @@
+/* Product C = A * op(B) whose result is known to be symmetric, such as A * A^T. Only TILE_SIZE x TILE_SIZE blocks of C
+ * on and below the diagonal (above it with UPPER) are computed, which is about half of the work of a general product.
+ * Group id 0 enumerates the blocks of the triangle row by row, so no work-groups are launched for the other one. With
+ * MIRROR every element is also stored to its transposed position, otherwise the other triangle of C isn't written.
+ *
+ * B is read transposed when trans_B is set, so A * A^T is computed by passing A twice without forming the transpose.
+ * EPILOGUE is applied to every element of C before it's stored. It shouldn't depend on the column, since the result
+ * wouldn't be symmetric otherwise.
+ *
+ *  @kernel    ( {"name" : "matmult_syrk_kernel", "entry" : "syrk"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "cl::Buffer", "int", "int", "int"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type": "unsigned", "name": "TILE_SIZE"}, {"type": "unsigned", "name": "UPPER"}, {"type": "unsigned", "name": "MIRROR"}, {"type": "std::string", "name": "EPILOGUE"}] )
+ *
+ */
+
+__kernel void syrk(__global const TYPE *A, __global const TYPE *B, __global TYPE *C, int N, int AY, int trans_B) {
+  // Block b of the lower triangle is (block_row, block_col) with b = block_row * (block_row + 1) / 2 + block_col. The
+  // square root is only a guess, which is corrected for rounding errors of large indices.
+  const int b = get_group_id(0);
+  int block_row = (int)((sqrt(8.0f * b + 1.0f) - 1.0f) / 2.0f);
+  while (block_row * (block_row + 1) / 2 > b) --block_row;
+  while ((block_row + 1) * (block_row + 2) / 2 <= b) ++block_row;
+  const int block_col = b - block_row * (block_row + 1) / 2;
+
+#if UPPER
+  const int tile_row = block_col * TILE_SIZE, tile_col = block_row * TILE_SIZE;
+#else
+  const int tile_row = block_row * TILE_SIZE, tile_col = block_col * TILE_SIZE;
+#endif
+
+  const int local_row = get_local_id(0);
+  const int local_col = get_local_id(1);
+
+  const int row = tile_row + local_row;
+  const int col = tile_col + local_col;
+
+  __local TYPE tile_A[TILE_SIZE * TILE_SIZE];
+  __local TYPE tile_B[TILE_SIZE * TILE_SIZE];
+
+  const int tile_count = (AY + TILE_SIZE - 1) / TILE_SIZE;
+  TYPE sum = 0;
+
+  for (int t = 0; t < tile_count; ++t) {
+    const int k_col = t * TILE_SIZE + local_col;
+    const int k_row = t * TILE_SIZE + local_row;
+
+    tile_A[local_row * TILE_SIZE + local_col] = ((row < N && k_col < AY) ? A[(ulong)row * AY + k_col] : 0);
+
+    // Transposed B is read along its rows as well, so that loads stay coalesced, and transposed in local memory
+    if (trans_B) {
+      const int b_row = tile_col + local_row;
+      tile_B[local_col * TILE_SIZE + local_row] = ((b_row < N && k_col < AY) ? B[(ulong)b_row * AY + k_col] : 0);
+    } else {
+      tile_B[local_row * TILE_SIZE + local_col] = ((k_row < AY && col < N) ? B[(ulong)k_row * N + col] : 0);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int k = 0; k < TILE_SIZE; ++k) {
+      sum += tile_A[local_row * TILE_SIZE + k] * tile_B[k * TILE_SIZE + local_col];
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  // Diagonal blocks are computed whole, but only their half in the triangle is stored
+#if UPPER
+  if (row >= N || col >= N || col < row) return;
+#else
+  if (row >= N || col >= N || row < col) return;
+#endif
+
+  TYPE result = sum;
+  EPILOGUE;
+
+  C[(ulong)row * N + col] = result;
+#if MIRROR
+  if (row != col) C[(ulong)col * N + row] = result;
+#endif
+}
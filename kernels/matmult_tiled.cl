@@ -1,44 +1,145 @@
-/* Tiled matrix multiplication with local memory
+/* Tiled matrix multiplication with local memory. A TILE_M x TILE_N work-group computes a block of C, multiplying
+ * TILE_M x TILE_K tiles of A by TILE_K x TILE_N tiles of B, which work-items load together. With PREFETCH the next pair
+ * of tiles is read into registers before computing the current one and stored into the second pair of local buffers
+ * afterwards, so global memory latency is hidden behind the computation and only one barrier per tile is needed.
+ *
+ * Computes C = alpha * op(A) * op(B) + beta * C with the same arguments as tiled_arbitrary, but AX, BY and AY should be
+ * multiples of TILE_M, TILE_N and TILE_K respectively.
  *
  *  @kernel    ( {"name" : "matmult_tiled_kernel", "entry" : "tiled"} )
- *  @signature ( ["cl::Buffer", "cl::Buffer", "cl::Buffer", "int", "int", "int"] )
- *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type": "unsigned", "name": "TILE_SIZE"}] )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "cl::Buffer", "int", "int", "int", "int", "int", "int", "cl_ulong", "cl_ulong", "cl_ulong", "int", "int", "cl_ulong", "cl_ulong", "cl::Buffer"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type": "unsigned", "name": "TILE_M"}, {"type": "unsigned", "name": "TILE_N"}, {"type": "unsigned", "name": "TILE_K"}, {"type": "unsigned", "name": "PREFETCH"}, {"type": "std::string", "name": "EPILOGUE"}] )
  *
  */
 
-__kernel void tiled(__global TYPE *A, __global TYPE *B, __global TYPE *C, int AX, int AY, int BY) {
-  int tile_row = get_group_id(0);
-  int tile_col = get_group_id(1);
+#define THREADS (TILE_M * TILE_N)
+#define LOADS_A ((TILE_M * TILE_K + THREADS - 1) / THREADS)
+#define LOADS_B ((TILE_K * TILE_N + THREADS - 1) / THREADS)
+
+TYPE from_bits(ulong bits) {
+  union {
+    TYPE value;
+    ulong bits;
+  } u;
+
+  u.bits = bits;
+  return u.value;
+}
+
+TYPE fetch(__global const TYPE *M, int row, int col, int ld, int trans) {
+  return (trans ? M[col * ld + row] : M[row * ld + col]);
+}
+
+// Element e of a tile_rows x tile_cols tile handled by work-item id in its i-th load. Consecutive work-items take
+// consecutive elements along the dimension that is contiguous in memory, so global loads are coalesced.
+int tile_element(int i, int id, int tile_rows, int tile_cols, int trans, int *row, int *col) {
+  const int e = i * THREADS + id;
+  *row = (trans ? e % tile_rows : e / tile_cols);
+  *col = (trans ? e / tile_rows : e % tile_cols);
+  return e < tile_rows * tile_cols;
+}
+
+void fetch_tile(TYPE *regs, int loads, int tile_rows, int tile_cols, __global const TYPE *M, int row0, int col0, int ld,
+                int trans, int id) {
+  for (int i = 0; i < loads; ++i) {
+    int row, col;
+    regs[i] = (tile_element(i, id, tile_rows, tile_cols, trans, &row, &col)
+                   ? fetch(M, row0 + row, col0 + col, ld, trans)
+                   : 0);
+  }
+}
+
+void store_tile(__local TYPE *tile, const TYPE *regs, int loads, int tile_rows, int tile_cols, int trans, int id) {
+  for (int i = 0; i < loads; ++i) {
+    int row, col;
+    if (tile_element(i, id, tile_rows, tile_cols, trans, &row, &col)) tile[row * tile_cols + col] = regs[i];
+  }
+}
+
+__kernel void tiled(__global const TYPE *A, __global const TYPE *B, __global TYPE *C, int AX, int AY, int BY, int lda,
+                    int ldb, int ldc, ulong offset_A, ulong offset_B, ulong offset_C, int trans_A, int trans_B,
+                    ulong alpha_bits, ulong beta_bits, __global const TYPE *bias) {
+  A += offset_A;
+  B += offset_B;
+  C += offset_C;
+
+  int tile_row = get_group_id(0) * TILE_M;
+  int tile_col = get_group_id(1) * TILE_N;
 
   int local_row = get_local_id(0);
   int local_col = get_local_id(1);
+  // Dimension 0 varies fastest between neighbouring work-items
+  int local_id = local_col * TILE_M + local_row;
 
-  __local TYPE tile_A[TILE_SIZE * TILE_SIZE];
-  __local TYPE tile_B[TILE_SIZE * TILE_SIZE];
+  int global_row = tile_row + local_row;
+  int global_col = tile_col + local_col;
 
-  int global_row = TILE_SIZE * tile_row + local_row;
-  int global_col = TILE_SIZE * tile_col + local_col;
-
-  int tile_count = AY / TILE_SIZE;
+  int tile_count = AY / TILE_K;
+  TYPE regs_A[LOADS_A], regs_B[LOADS_B];
   TYPE sum = 0;
 
+#if PREFETCH
+  __local TYPE tile_A[2][TILE_M * TILE_K];
+  __local TYPE tile_B[2][TILE_K * TILE_N];
+
+  fetch_tile(regs_A, LOADS_A, TILE_M, TILE_K, A, tile_row, 0, lda, trans_A, local_id);
+  fetch_tile(regs_B, LOADS_B, TILE_K, TILE_N, B, 0, tile_col, ldb, trans_B, local_id);
+  store_tile(tile_A[0], regs_A, LOADS_A, TILE_M, TILE_K, trans_A, local_id);
+  store_tile(tile_B[0], regs_B, LOADS_B, TILE_K, TILE_N, trans_B, local_id);
+  barrier(CLK_LOCAL_MEM_FENCE);
+
   for (int t = 0; t < tile_count; ++t) {
-    // Step 1. Here each work group thread is responsible for copying data into the corresponding slot in the tile_A,
-    // tile_B
-    tile_A[local_row * TILE_SIZE + local_col] = A[global_row * AY + t * TILE_SIZE + local_col];
-    tile_B[local_row * TILE_SIZE + local_col] = B[BY * (t * TILE_SIZE + local_row) + global_col];
+    int curr = t & 1, has_next = (t + 1 < tile_count);
+
+    // Step 1. Issue global loads of the next tiles. They are only needed after the computation.
+    if (has_next) {
+      fetch_tile(regs_A, LOADS_A, TILE_M, TILE_K, A, tile_row, (t + 1) * TILE_K, lda, trans_A, local_id);
+      fetch_tile(regs_B, LOADS_B, TILE_K, TILE_N, B, (t + 1) * TILE_K, tile_col, ldb, trans_B, local_id);
+    }
+
+    // Step 2. Calculate part of the resulting tile corresponding to this thread and accumulate it in sum.
+    for (int k = 0; k < TILE_K; ++k) {
+      sum += tile_A[curr][TILE_K * local_row + k] * tile_B[curr][k * TILE_N + local_col];
+    }
+
+    // Step 3. The other buffer was last read before the previous barrier, so it can be overwritten without waiting.
+    if (has_next) {
+      store_tile(tile_A[curr ^ 1], regs_A, LOADS_A, TILE_M, TILE_K, trans_A, local_id);
+      store_tile(tile_B[curr ^ 1], regs_B, LOADS_B, TILE_K, TILE_N, trans_B, local_id);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+#else
+  __local TYPE tile_A[TILE_M * TILE_K];
+  __local TYPE tile_B[TILE_K * TILE_N];
+
+  for (int t = 0; t < tile_count; ++t) {
+    // Step 1. Work-items copy data into tile_A and tile_B together, each taking LOADS_A and LOADS_B elements
+    fetch_tile(regs_A, LOADS_A, TILE_M, TILE_K, A, tile_row, t * TILE_K, lda, trans_A, local_id);
+    fetch_tile(regs_B, LOADS_B, TILE_K, TILE_N, B, t * TILE_K, tile_col, ldb, trans_B, local_id);
+    store_tile(tile_A, regs_A, LOADS_A, TILE_M, TILE_K, trans_A, local_id);
+    store_tile(tile_B, regs_B, LOADS_B, TILE_K, TILE_N, trans_B, local_id);
 
     // Barrier here to finish loading all the data before proceeding.
     barrier(CLK_LOCAL_MEM_FENCE);
 
     // Step 2. Calculate part of the resulting tile corresponding to this thread and accumulate it in sum.
-    for (int k = 0; k < TILE_SIZE; ++k) {
-      sum += tile_A[TILE_SIZE * local_row + k] * tile_B[k * TILE_SIZE + local_col];
+    for (int k = 0; k < TILE_K; ++k) {
+      sum += tile_A[TILE_K * local_row + k] * tile_B[k * TILE_N + local_col];
     }
 
     // Wait for all threads to finish before reloading new tiles.
     barrier(CLK_LOCAL_MEM_FENCE);
   }
+#endif
+
+  TYPE alpha = from_bits(alpha_bits), beta = from_bits(beta_bits);
+  TYPE result = alpha * sum;
+  if (beta != 0) result += beta * C[global_row * ldc + global_col];
+
+  const int col = global_col;
+  EPILOGUE;
 
-  C[global_row * BY + global_col] = sum;
-}
\ No newline at end of file
+  C[global_row * ldc + global_col] = result;
+}
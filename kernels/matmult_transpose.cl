@@ -0,0 +1,33 @@
+/* Out of place transpose of a ROWS x COLS row-major matrix through local memory. A TILE_SIZE x TILE_SIZE work-group
+ * reads a tile along the rows of the source and writes it along the rows of the destination, so both global accesses
+ * are coalesced. Rows of the local tile are padded by one element, so that a column of the tile, which is read when
+ * writing the destination, spans TILE_SIZE different banks instead of hitting the same one.
+ *
+ *  @kernel    ( {"name" : "matmult_transpose_kernel", "entry" : "transpose"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "int", "int"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type": "unsigned", "name": "TILE_SIZE"}] )
+ *
+ */
+
+__kernel void transpose(__global const TYPE *src, __global TYPE *dst, int ROWS, int COLS) {
+  __local TYPE tile[TILE_SIZE * (TILE_SIZE + 1)];
+
+  // Dimension 0 runs along the rows, so neighbouring work-items access neighbouring elements
+  const int local_x = get_local_id(0);
+  const int local_y = get_local_id(1);
+
+  const int src_row = get_group_id(1) * TILE_SIZE + local_y;
+  const int src_col = get_group_id(0) * TILE_SIZE + local_x;
+  if (src_row < ROWS && src_col < COLS) {
+    tile[local_y * (TILE_SIZE + 1) + local_x] = src[(ulong)src_row * COLS + src_col];
+  }
+
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  // Block (i, j) of the source is block (j, i) of the destination
+  const int dst_row = get_group_id(0) * TILE_SIZE + local_y;
+  const int dst_col = get_group_id(1) * TILE_SIZE + local_x;
+  if (dst_row < COLS && dst_col < ROWS) {
+    dst[(ulong)dst_row * ROWS + dst_col] = tile[local_x * (TILE_SIZE + 1) + local_y];
+  }
+}
@@ -0,0 +1,66 @@
+/* Product C = A * B with a triangular N x N matrix A, which is lower triangular or upper triangular with UPPER. Only
+ * tiles of A that have nonzero elements are multiplied, so a work-group walks row_block + 1 tiles for a lower A and
+ * the rest of them for an upper one, about half of the work of a general product. Elements of A in the other triangle
+ * are taken as zero and never read, so it may hold anything. EPILOGUE is applied to every element of C before it's
+ * stored, see matmult::epilogue.
+ *
+ *  @kernel    ( {"name" : "matmult_trmm_kernel", "entry" : "trmm"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "cl::Buffer", "int", "int", "cl::Buffer"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type": "unsigned", "name": "TILE_SIZE"}, {"type": "unsigned", "name": "UPPER"}, {"type": "std::string", "name": "EPILOGUE"}] )
+ *
+ */
+
+__kernel void trmm(__global const TYPE *A, __global const TYPE *B, __global TYPE *C, int N, int BY,
+                   __global const TYPE *bias) {
+  const int tile_row = get_group_id(0);
+  const int tile_col = get_group_id(1);
+
+  const int local_row = get_local_id(0);
+  const int local_col = get_local_id(1);
+
+  const int row = TILE_SIZE * tile_row + local_row;
+  const int global_col = TILE_SIZE * tile_col + local_col;
+
+  __local TYPE tile_A[TILE_SIZE * TILE_SIZE];
+  __local TYPE tile_B[TILE_SIZE * TILE_SIZE];
+
+  // Tiles of A left of the diagonal block are zero for an upper A, tiles right of it are zero for a lower one
+#if UPPER
+  const int first = tile_row, last = (N + TILE_SIZE - 1) / TILE_SIZE;
+#else
+  const int first = 0, last = tile_row + 1;
+#endif
+
+  TYPE sum = 0;
+
+  for (int t = first; t < last; ++t) {
+    const int k_col = t * TILE_SIZE + local_col;
+    const int k_row = t * TILE_SIZE + local_row;
+
+#if UPPER
+    const int in_triangle = (k_col >= row);
+#else
+    const int in_triangle = (k_col <= row);
+#endif
+
+    tile_A[local_row * TILE_SIZE + local_col] =
+        ((row < N && k_col < N && in_triangle) ? A[(ulong)row * N + k_col] : 0);
+    tile_B[local_row * TILE_SIZE + local_col] = ((k_row < N && global_col < BY) ? B[(ulong)k_row * BY + global_col] : 0);
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int k = 0; k < TILE_SIZE; ++k) {
+      sum += tile_A[local_row * TILE_SIZE + k] * tile_B[k * TILE_SIZE + local_col];
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if (row >= N || global_col >= BY) return;
+
+  const int col = global_col;
+  TYPE result = sum;
+  EPILOGUE;
+
+  C[(ulong)row * BY + col] = result;
+}
@@ -0,0 +1,58 @@
+/* Fill a buffer with elements [offset, offset + global size) of the Philox4x32-10 stream, identical to
+ * clutils::counter_based_generator on the host. Bounds are encoded by clutils::encode_bound: sign-extended integers or
+ * raw bits of floating point values. FLOAT_BITS is the number of random mantissa bits, 0 for integral types.
+ *
+ *  @kernel    ( {"name" : "philox_fill_kernel", "entry" : "philox_fill"} )
+ *  @signature ( ["cl::Buffer", "cl_ulong", "cl_ulong", "cl_ulong", "cl_ulong"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "unsigned", "name": "FLOAT_BITS"}, {"type" : "std::string", "name": "INDEX_TYPE"}] )
+ *
+ */
+
+uint4 philox4x32_10(uint4 ctr, uint2 key) {
+  const uint multiplier_0 = 0xD2511F53, multiplier_1 = 0xCD9E8D57;
+  const uint weyl_0 = 0x9E3779B9, weyl_1 = 0xBB67AE85;
+
+  for (uint round = 0; round < 10; ++round) {
+    if (round) key += (uint2)(weyl_0, weyl_1);
+
+    const uint hi_0 = mul_hi(multiplier_0, ctr.x), lo_0 = multiplier_0 * ctr.x;
+    const uint hi_1 = mul_hi(multiplier_1, ctr.z), lo_1 = multiplier_1 * ctr.z;
+    ctr = (uint4)(hi_1 ^ ctr.y ^ key.x, lo_1, hi_0 ^ ctr.w ^ key.y, lo_0);
+  }
+
+  return ctr;
+}
+
+TYPE decode_bound(ulong bits) {
+#if FLOAT_BITS
+  union {
+    TYPE value;
+    ulong bits;
+  } u;
+
+  u.bits = bits;
+  return u.value;
+#else
+  return (TYPE)bits;
+#endif
+}
+
+__kernel void philox_fill(__global TYPE *buf, ulong offset, ulong seed, ulong lower, ulong upper) {
+  INDEX_TYPE gid = get_global_id(0);
+  const ulong index = offset + gid;
+
+  const uint4 ctr = (uint4)((uint)index, (uint)(index >> 32), 0, 0);
+  const uint2 key = (uint2)((uint)seed, (uint)(seed >> 32));
+
+  const uint4 res = philox4x32_10(ctr, key);
+  const ulong bits = ((ulong)res.y << 32) | res.x;
+
+#if FLOAT_BITS
+  const TYPE lower_value = decode_bound(lower), upper_value = decode_bound(upper);
+  const TYPE unit = ldexp((TYPE)(bits >> (64 - FLOAT_BITS)), -FLOAT_BITS);
+  buf[gid] = fma(unit, upper_value - lower_value, lower_value);
+#else
+  const ulong span = upper - lower + 1;
+  buf[gid] = decode_bound(lower + (span ? bits % span : bits));
+#endif
+}
@@ -0,0 +1,59 @@
+/* Check that a sequence is sorted and compute its multiset hash: the sum of splitmix64 finalizers of element bits
+ * modulo 2^64, same as clutils::multiset_hash on the host. Each work-group writes its partial sum into partial_hashes,
+ * unsorted is set to a non-zero value if any pair of neighbours is out of order.
+ *
+ *  @kernel    ( {"name" : "sort_validate_kernel", "entry" : "sort_validate"} )
+ *  @signature ( ["cl::Buffer", "cl_ulong", "cl::Buffer", "cl::Buffer"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "unsigned", "name": "WORK_GROUP_SIZE"}, {"type" : "std::string", "name": "INDEX_TYPE"}] )
+ *
+ */
+
+ulong mix_bits(ulong x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9UL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebUL;
+  x ^= x >> 31;
+  return x;
+}
+
+ulong element_hash(TYPE value) {
+  union {
+    TYPE value;
+    ulong bits;
+  } u;
+
+  u.bits = 0;
+  u.value = value;
+  return mix_bits(u.bits);
+}
+
+__kernel void sort_validate(__global TYPE *buf, ulong size, __global ulong *partial_hashes, __global int *unsorted) {
+  INDEX_TYPE gid = get_global_id(0);
+  INDEX_TYPE global_size = get_global_size(0);
+  uint lid = get_local_id(0);
+
+  ulong hash = 0;
+  int out_of_order = 0;
+
+  for (INDEX_TYPE i = gid; i < size; i += global_size) {
+    const TYPE value = buf[i];
+    hash += element_hash(value);
+    if (i + 1 < size && value > buf[i + 1]) out_of_order = 1;
+    // With 32-bit indices and size close to 2^32, i += global_size could wrap around and start over
+    if (size - i <= global_size) break;
+  }
+
+  if (out_of_order) atomic_or(unsorted, 1);
+
+  __local ulong hashes[WORK_GROUP_SIZE];
+  hashes[lid] = hash;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (uint stride = WORK_GROUP_SIZE / 2; stride > 0; stride /= 2) {
+    if (lid < stride) hashes[lid] += hashes[lid + stride];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if (lid == 0) partial_hashes[get_group_id(0)] = hashes[0];
+}
@@ -0,0 +1,25 @@
+/* CSR sparse matrix by dense matrix product, C = A * B, where B is row-major with BY columns. Dimension 0 enumerates
+ * columns of B, so neighbouring work-items read consecutive elements of a row of B. Dimension 1 enumerates rows of A
+ * in the order of the rows list, which is sorted by length, so that items of a work-group do similar amounts of work.
+ *
+ *  @kernel    ( {"name" : "sparse_spmm_kernel", "entry" : "spmm"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "int", "int"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}] )
+ *
+ */
+
+__kernel void spmm(__global const uint *row_ptr, __global const uint *col_idx, __global const TYPE *values,
+                   __global const TYPE *B, __global TYPE *C, __global const uint *rows, int count, int BY) {
+  const int col = get_global_id(0);
+  const int index = get_global_id(1);
+  if (col >= BY || index >= count) return;
+
+  const uint row = rows[index];
+
+  TYPE sum = 0;
+  for (uint k = row_ptr[row]; k < row_ptr[row + 1]; ++k) {
+    sum += values[k] * B[(ulong)col_idx[k] * BY + col];
+  }
+
+  C[(ulong)row * BY + col] = sum;
+}
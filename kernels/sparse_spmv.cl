@@ -0,0 +1,47 @@
+/* CSR sparse matrix by dense vector product, y = A * x. Rows are taken from the rows list, which holds rows of similar
+ * length. Without VECTOR each work-item computes one short row. With VECTOR a work-group of WORK_GROUP_SIZE items
+ * (a power of two) splits one long row and reduces partial sums in local memory, so that a few long rows don't keep
+ * the rest of the device waiting.
+ *
+ *  @kernel    ( {"name" : "sparse_spmv_kernel", "entry" : "spmv"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "int"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type": "unsigned", "name": "VECTOR"}, {"type": "unsigned", "name": "WORK_GROUP_SIZE"}] )
+ *
+ */
+
+__kernel void spmv(__global const uint *row_ptr, __global const uint *col_idx, __global const TYPE *values,
+                   __global const TYPE *x, __global TYPE *y, __global const uint *rows, int count) {
+#if VECTOR
+  __local TYPE partial[WORK_GROUP_SIZE];
+
+  const int lid = get_local_id(0);
+  const uint row = rows[get_group_id(0)];
+
+  TYPE sum = 0;
+  for (uint k = row_ptr[row] + lid; k < row_ptr[row + 1]; k += WORK_GROUP_SIZE) {
+    sum += values[k] * x[col_idx[k]];
+  }
+
+  partial[lid] = sum;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (int stride = WORK_GROUP_SIZE / 2; stride > 0; stride /= 2) {
+    if (lid < stride) partial[lid] += partial[lid + stride];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if (lid == 0) y[row] = partial[0];
+#else
+  const int index = get_global_id(0);
+  if (index >= count) return;
+
+  const uint row = rows[index];
+
+  TYPE sum = 0;
+  for (uint k = row_ptr[row]; k < row_ptr[row + 1]; ++k) {
+    sum += values[k] * x[col_idx[k]];
+  }
+
+  y[row] = sum;
+#endif
+}
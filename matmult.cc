@@ -8,16 +8,28 @@
  * ----------------------------------------------------------------------------
  */
 
-#include "opencl_include.hpp"
-#include "selector.hpp"
+#define STRINGIFY0(v) #v
+#define STRINGIFY(v) STRINGIFY0(v)
+
+#ifndef TYPE__
+#define TYPE__ int
+#endif
+
+#include "chain.hpp"
+#include "matmult.hpp"
+#include "sparse.hpp"
 #include "utils.hpp"
+#include "validation.hpp"
 
 #include <algorithm>
+#include <cctype>
 #include <chrono>
+#include <cmath>
 #include <cstdlib>
 #include <functional>
 #include <iostream>
 #include <iterator>
+#include <map>
 #include <memory>
 #include <random>
 #include <span>
@@ -26,192 +38,302 @@
 #include <string>
 
 #include <type_traits>
+#include <vector>
 
 #include "popl.hpp"
 
-#include "linmath/contiguous_matrix.hpp"
+#ifdef EIGEN_MAT_MULT
+#include <Eigen/Dense>
+using eigen_matrix_type = Eigen::Matrix<TYPE__, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+#endif
 
-#include "kernelhpp/matmult_naive_kernel.hpp"
-#include "kernelhpp/matmult_tiled_arb_kernel.hpp"
-#include "kernelhpp/matmult_tiled_kernel.hpp"
+using matrix_type = matmult::host_matrix<TYPE__>;
+using cpu_matmult = matmult::cpu_matmult<TYPE__>;
 
-#define STRINGIFY0(v) #v
-#define STRINGIFY(v) STRINGIFY0(v)
+template <typename T> struct type_name {};
+template <> struct type_name<TYPE__> {
+  static constexpr const char *name_str = STRINGIFY(TYPE__);
+};
 
-#ifndef TYPE__
-#define TYPE__ int
-#endif
+using naive_matmult = matmult::naive_matmult<TYPE__, type_name<TYPE__>>;
+using tiled_matmult = matmult::tiled_matmult<TYPE__, type_name<TYPE__>>;
+using tiled_arbitrary_matmult = matmult::tiled_arbitrary_matmult<TYPE__, type_name<TYPE__>>;
+using regblocked_matmult = matmult::regblocked_matmult<TYPE__, type_name<TYPE__>>;
+using batched_matmult = matmult::batched_matmult<TYPE__, type_name<TYPE__>>;
+using out_of_core_matmult = matmult::out_of_core_matmult<TYPE__, type_name<TYPE__>>;
+using strassen_matmult = matmult::strassen_matmult<TYPE__, type_name<TYPE__>>;
+using mixed_matmult = matmult::mixed_matmult<TYPE__>;
+using sparse_matmult = matmult::sparse_matmult<TYPE__, type_name<TYPE__>>;
+using symmetric_matmult = matmult::symmetric_matmult<TYPE__, type_name<TYPE__>>;
+using triangular_matmult = matmult::triangular_matmult<TYPE__, type_name<TYPE__>>;
+using chain_matmult = matmult::chain_matmult<TYPE__>;
+
+namespace {
 
 #ifdef EIGEN_MAT_MULT
-#include <Eigen/Dense>
-using eigen_matrix_type = Eigen::Matrix<TYPE__, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+eigen_matrix_type to_eigen_matrix(const matrix_type &matrix) {
+  eigen_matrix_type e = Eigen::Map<const eigen_matrix_type>(matrix.data(), matrix.rows(), matrix.cols());
+  return e;
+}
 #endif
 
-namespace linmath = throttle::linmath;
+// Compare throughput of a single batched launch with a loop of separate products by the same tiledarb configuration
+int run_batched(unsigned batch, unsigned ax, unsigned ay, unsigned by, matmult::tile_shape shape, bool prefetch,
+                TYPE__ lower, TYPE__ upper, bool skip_cpu) {
+  const auto print_sep = []() { std::cout << " -------- \n"; };
+  std::cout << "Multiplying " << batch << " pairs of A [" << ax << " x " << ay << "] by B [" << ay << " x " << by
+            << "]\n";
+  print_sep();
 
-using matrix_type = linmath::contiguous_matrix<TYPE__>;
+  std::vector<matrix_type> as, bs;
+  as.reserve(batch);
+  bs.reserve(batch);
+
+  auto random_filler = clutils::create_random_number_generator<TYPE__>(lower, upper);
+  for (unsigned i = 0; i < batch; ++i) {
+    matrix_type a{ax, ay}, b{ay, by};
+    random_filler(a);
+    random_filler(b);
+    as.push_back(std::move(a));
+    bs.push_back(std::move(b));
+  }
 
-namespace app {
+  matmult::gpu_matmult<TYPE__> base;
+  batched_matmult batched{shape, base, prefetch};
+  tiled_arbitrary_matmult single{shape, base, prefetch};
 
-struct matrix_sizes {
-  matrix_type::size_type ax, ay, by;
-};
+  const auto print_rate = [batch](auto name, std::chrono::milliseconds time) {
+    std::cout << name << " wall time: " << time.count() << " ms";
+    if (time.count()) std::cout << " (" << 1000.0 * batch / time.count() << " matrices/s)";
+    std::cout << "\n";
+  };
 
-struct ndrange_query {
-  cl::NDRange global, local;
-};
+  auto loop_start = std::chrono::high_resolution_clock::now();
+  std::vector<matrix_type> loop_res;
+  loop_res.reserve(batch);
+  for (unsigned i = 0; i < batch; ++i) {
+    loop_res.push_back(single.multiply(as[i], bs[i]));
+  }
+  auto loop_end = std::chrono::high_resolution_clock::now();
 
-using clutils::profiling_info;
-class i_matmult {
-public:
-  virtual matrix_type operator()(const matrix_type &, const matrix_type &, profiling_info *) = 0;
+  clutils::profiling_info prof_info;
+  auto res = batched.multiply_batch(as, bs, &prof_info);
 
-  matrix_type multiply(const matrix_type &mata, const matrix_type &matb, profiling_info *time = nullptr) {
-    return operator()(mata, matb, time);
-  }
+  print_rate("Loop of tiledarb", std::chrono::duration_cast<std::chrono::milliseconds>(loop_end - loop_start));
+  print_rate("Batched", prof_info.wall);
+  print_rate("Batched pure", prof_info.pure);
 
-  virtual ~i_matmult() {}
-};
+  print_sep();
 
-class gpu_matmult : public i_matmult, protected clutils::platform_selector {
-protected:
-  cl::Context m_ctx;
-  cl::CommandQueue m_queue;
+  if (skip_cpu) return EXIT_SUCCESS;
 
-protected:
-  static constexpr clutils::platform_version c_api_version = {2, 2};
+  for (unsigned i = 0; i < batch; ++i) {
+    if (res[i] == as[i] * bs[i] && loop_res[i] == res[i]) continue;
+    std::cout << "Batched matrix multiplication is borked at index " << i << "\n";
+    return EXIT_FAILURE;
+  }
 
-  gpu_matmult()
-      : clutils::platform_selector{c_api_version}, m_ctx{m_device}, m_queue{m_ctx, cl::QueueProperties::Profiling} {}
+  std::cout << "Batched matrix multiplication works fine\n";
+  return EXIT_SUCCESS;
+}
 
-  using func_signature = cl::Event(cl::Buffer, cl::Buffer, cl::Buffer);
-  matrix_type run_boilerplate(const matrix_type &mata, const matrix_type &matb, std::function<func_signature> func,
-                              profiling_info *time) {
-    if (mata.cols() != matb.rows()) throw std::invalid_argument{"Mismatched matrix sizes"};
+// Chain dimensions "d0,d1,...,dn" of matrices d0 x d1, d1 x d2, ...
+std::vector<std::size_t> parse_chain(const std::string &str) {
+  std::vector<std::size_t> dims;
+  std::stringstream ss{str};
+  for (std::string part; std::getline(ss, part, ',');) {
+    if (part.empty() || !std::all_of(part.begin(), part.end(), [](unsigned char c) { return std::isdigit(c); }))
+      throw std::invalid_argument{"Chain should be a list of dimensions d0,d1,...,dn, got " + str};
+    dims.push_back(std::stoul(part));
+  }
+  return dims;
+}
 
-    const auto mat_size = [](const auto &m) { return std::distance(m.begin(), m.end()); };
-    const auto mat_bin_size = [&mat_size](const auto &m) { return mat_size(m) * sizeof(matrix_type::value_type); };
+// Multiply a chain in the optimal order with intermediates kept on the device
+int run_chain(const std::vector<std::size_t> &dims, unsigned tile, TYPE__ lower, TYPE__ upper, bool skip_cpu) {
+  const matmult::chain_order order{dims};
+  const auto print_sep = []() { std::cout << " -------- \n"; };
+  std::cout << "Multiplying a chain of " << order.size() << " matrices:";
+  for (std::size_t i = 0; i < order.size(); ++i) {
+    std::cout << " [" << dims[i] << " x " << dims[i + 1] << "]";
+  }
+  std::cout << "\n";
+  print_sep();
 
-    auto wall_start = std::chrono::high_resolution_clock::now();
+  const auto plan = chain_matmult::make_plan(order);
+  std::size_t scratch = 0;
+  for (const auto capacity : plan.capacities) {
+    scratch += capacity;
+  }
 
-    matrix_type matc = {mata.rows(), matb.cols()};
+  std::cout << "Optimal order: " << order.to_string() << "\n";
+  std::cout << "Multiply-adds: " << order.cost() << " optimal, " << order.naive_cost() << " left to right";
+  if (order.cost()) std::cout << " (" << order.naive_cost() / order.cost() << "x)";
+  std::cout << "\n";
+  std::cout << "Scratch buffers: " << plan.capacities.size() << " for " << plan.steps.size() - 1 << " intermediates, "
+            << scratch * sizeof(TYPE__) << " bytes\n";
+
+  std::vector<matrix_type> chain;
+  chain.reserve(order.size());
+  auto random_filler = clutils::create_random_number_generator<TYPE__>(lower, upper);
+  for (std::size_t i = 0; i < order.size(); ++i) {
+    matrix_type mat{dims[i], dims[i + 1]};
+    random_filler(mat);
+    chain.push_back(std::move(mat));
+  }
 
-    cl::Buffer bufa = {m_ctx, CL_MEM_READ_ONLY, mat_bin_size(mata)};
-    cl::Buffer bufb = {m_ctx, CL_MEM_READ_ONLY, mat_bin_size(matb)};
-    cl::Buffer bufc = {m_ctx, CL_MEM_WRITE_ONLY, mat_bin_size(matc)};
+  tiled_arbitrary_matmult engine{tile};
+  chain_matmult chain_mult{engine};
 
-    cl::copy(m_queue, mata.begin(), mata.end(), bufa);
-    cl::copy(m_queue, matb.begin(), matb.end(), bufb);
+  clutils::profiling_info prof_info;
+  auto res = chain_mult.multiply_chain(chain, &prof_info);
 
-    auto event = func(bufa, bufb, bufc);
-    event.wait();
-    cl::copy(m_queue, bufc, matc.begin(), matc.end());
-    auto wall_end = std::chrono::high_resolution_clock::now();
+  const double flop = 2.0 * order.cost();
+  const auto print_time = [flop](auto name, std::chrono::milliseconds time) {
+    std::cout << name << " time: " << time.count() << " ms";
+    if (time.count()) std::cout << " (" << flop / time.count() / 1e6 << " GFLOP/s)";
+    std::cout << "\n";
+  };
 
-    std::chrono::nanoseconds pure_start{event.getProfilingInfo<CL_PROFILING_COMMAND_START>()},
-        pure_end{event.getProfilingInfo<CL_PROFILING_COMMAND_END>()};
+  print_time("GPU wall", prof_info.wall);
+  print_time("GPU pure", prof_info.pure);
+  print_sep();
 
-    auto pure = std::chrono::duration_cast<std::chrono::milliseconds>(pure_end - pure_start);
-    auto wall = std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start);
+  if (skip_cpu) return EXIT_SUCCESS;
 
-    if (time) *time = {pure, wall};
-    return matc;
+  // Reference is multiplied from left to right, so a wrong order or a clobbered intermediate shows up
+  matrix_type c = chain.front();
+  for (std::size_t i = 1; i < chain.size(); ++i) {
+    c = cpu_matmult{}.multiply(c, chain[i]);
   }
-};
 
-class naive_matmult : public gpu_matmult {
-  using kernel = matmult_naive_kernel;
+  if (c == res) {
+    std::cout << "Matrix chain multiplication works fine\n";
+    return EXIT_SUCCESS;
+  }
 
-private:
-  cl::Program m_program;
-  kernel::functor_type m_functor;
+  std::cout << "Matrix chain multiplication is borked\n";
+  return EXIT_FAILURE;
+}
 
-public:
-  naive_matmult()
-      : gpu_matmult{}, m_program{m_ctx, kernel::source(STRINGIFY(TYPE__)), true}, m_functor{m_program,
-                                                                                            kernel::entry()} {}
+// Raise a square matrix to a power by repeated squaring on the device
+int run_power(unsigned long long k, unsigned size, unsigned tile, TYPE__ lower, TYPE__ upper, bool skip_cpu) {
+  const auto print_sep = []() { std::cout << " -------- \n"; };
+  std::cout << "Raising A [" << size << " x " << size << "] to the power of " << k << "\n";
+  print_sep();
 
-  matrix_type operator()(const matrix_type &mata, const matrix_type &matb, profiling_info *time = nullptr) override {
-    const auto func = [&](auto bufa, auto bufb, auto bufc) {
-      cl::EnqueueArgs args = {m_queue, {mata.rows(), matb.cols()}};
-      return m_functor(args, bufa, bufb, bufc, mata.rows(), mata.cols(), matb.cols());
-    };
-    return gpu_matmult::run_boilerplate(mata, matb, func, time);
+  unsigned products = 0;
+  for (auto bits = k; bits > 1; bits >>= 1) {
+    products += 1 + (bits & 1);
   }
-};
+  std::cout << "Products: " << products << " by squaring, " << (k ? k - 1 : 0) << " one by one\n";
 
-class tiled_matmult : public gpu_matmult {
-  using kernel = matmult_tiled_kernel;
+  matrix_type a{size, size};
+  clutils::create_random_number_generator<TYPE__>(lower, upper)(a);
 
-private:
-  cl::Program m_program;
-  kernel::functor_type m_functor;
+  tiled_arbitrary_matmult engine{tile};
+  chain_matmult chain_mult{engine};
 
-  unsigned m_tile_size;
+  clutils::profiling_info prof_info;
+  auto res = chain_mult.power(a, k, &prof_info);
 
-public:
-  tiled_matmult(unsigned tile_size)
-      : gpu_matmult{}, m_program{m_ctx, kernel::source(STRINGIFY(TYPE__), tile_size), true},
-        m_functor{m_program, kernel::entry()}, m_tile_size{tile_size} {}
+  const double flop = 2.0 * products * size * size * size;
+  const auto print_time = [flop](auto name, std::chrono::milliseconds time) {
+    std::cout << name << " time: " << time.count() << " ms";
+    if (time.count()) std::cout << " (" << flop / time.count() / 1e6 << " GFLOP/s)";
+    std::cout << "\n";
+  };
 
-  matrix_type operator()(const matrix_type &mata, const matrix_type &matb, profiling_info *time = nullptr) {
-    if (mata.rows() % m_tile_size != 0 || mata.cols() % m_tile_size != 0 || matb.cols() % m_tile_size != 0 ||
-        matb.rows() % m_tile_size != 0)
-      throw std::invalid_argument{"Matrix sizes should be divisible by the tile size"};
+  print_time("GPU wall", prof_info.wall);
+  print_time("GPU pure", prof_info.pure);
+  print_sep();
 
-    const auto func = [&](auto bufa, auto bufb, auto bufc) {
-      cl::EnqueueArgs args = {m_queue, {mata.rows(), matb.cols()}, {m_tile_size, m_tile_size}};
-      return m_functor(args, bufa, bufb, bufc, mata.rows(), mata.cols(), matb.cols());
-    };
+  if (skip_cpu) return EXIT_SUCCESS;
 
-    return gpu_matmult::run_boilerplate(mata, matb, func, time);
+  // Reference multiplies by A one factor at a time. Every power up to k is checked, since the buffers taken by the
+  // accumulated product and the square depend on the bits of the exponent.
+  matrix_type c{size, size};
+  for (unsigned i = 0; i < size; ++i) {
+    c.data()[i * size + i] = TYPE__{1};
   }
-};
-
-class tiled_arbitrary_matmult : public gpu_matmult {
-  using kernel = matmult_tiled_arb_kernel;
+  for (unsigned long long i = 0;; ++i) {
+    if (!(c == (i == k ? res : chain_mult.power(a, i)))) {
+      std::cout << "Matrix power is borked at power " << i << "\n";
+      return EXIT_FAILURE;
+    }
 
-private:
-  cl::Program m_program;
-  kernel::functor_type m_functor;
+    if (i == k) break;
+    c = cpu_matmult{}.multiply(c, a);
+  }
 
-  unsigned m_tile_size;
+  std::cout << "Matrix power works fine for all powers up to " << k << "\n";
+  return EXIT_SUCCESS;
+}
 
-public:
-  tiled_arbitrary_matmult(unsigned tile_size)
-      : gpu_matmult{}, m_program{m_ctx, kernel::source(STRINGIFY(TYPE__), tile_size), true},
-        m_functor{m_program, kernel::entry()}, m_tile_size{tile_size} {}
+// Row-major storage of the transpose, which is the column-major storage of the matrix itself
+matrix_type transposed(const matrix_type &mat) {
+  matrix_type res{mat.cols(), mat.rows()};
+  for (std::size_t i = 0; i < mat.rows(); ++i) {
+    for (std::size_t j = 0; j < mat.cols(); ++j) {
+      res.data()[j * mat.rows() + i] = mat.data()[i * mat.cols() + j];
+    }
+  }
+  return res;
+}
 
-  matrix_type operator()(const matrix_type &mata, const matrix_type &matb, profiling_info *time = nullptr) override {
-    const auto func = [&](auto bufa, auto bufb, auto bufc) {
-      const auto tile_sz = m_tile_size;
-      const auto recalc_size = [tile_sz](auto sz) {
-        if (sz % tile_sz == 0) return sz / tile_sz;
-        return (sz / tile_sz + 1);
-      };
+// Tile size "16" or tile shape "MxNxK" of the tiled kernels
+matmult::tile_shape parse_tile_shape(const std::string &str) {
+  std::vector<unsigned> dims;
+  std::stringstream ss{str};
+  for (std::string part; std::getline(ss, part, 'x');) {
+    if (part.empty() || !std::all_of(part.begin(), part.end(), [](unsigned char c) { return std::isdigit(c); }))
+      throw std::invalid_argument{"Tile shape should be a size or MxNxK, got " + str};
+    dims.push_back(std::stoul(part));
+  }
 
-      auto recalc_rows = recalc_size(mata.rows()) * tile_sz;
-      auto recalc_cols = recalc_size(matb.cols()) * tile_sz;
+  if (dims.size() == 1) return matmult::tile_shape::square(dims[0]);
+  if (dims.size() == 3) return matmult::tile_shape{dims[0], dims[1], dims[2]};
+  throw std::invalid_argument{"Tile shape should be a size or MxNxK, got " + str};
+}
 
-      cl::EnqueueArgs args = {m_queue, {recalc_rows, recalc_cols}, {tile_sz, tile_sz}};
+// Time tiled (when all sizes have to be divisible by the shape) or tiledarb with every tile shape that fits the device
+int run_sweep(bool divisible, unsigned ax, unsigned ay, unsigned by, bool prefetch) {
+  std::cout << "Sweeping tile shapes of " << (divisible ? "tiled" : "tiledarb") << " on A [" << ax << " x " << ay
+            << "] by B [" << ay << " x " << by << "]\n";
+
+  matmult::gpu_matmult<TYPE__> base;
+  const matmult::matrix_sizes sizes = {ax, ay, by};
+  const auto timings = (divisible ? matmult::sweep_tile_shapes<tiled_matmult>(base, sizes, prefetch)
+                                  : matmult::sweep_tile_shapes<tiled_arbitrary_matmult>(base, sizes, prefetch));
+  if (timings.empty()) {
+    std::cout << "No tile shape fits the device and these sizes\n";
+    return EXIT_FAILURE;
+  }
 
-      int tile_count = recalc_size(mata.cols());
-      return m_functor(args, bufa, bufb, bufc, mata.rows(), mata.cols(), matb.cols(), tile_count);
-    };
-    return gpu_matmult::run_boilerplate(mata, matb, func, time);
+  const double flop = 2.0 * ax * ay * by;
+  for (const auto &[shape, time] : timings) {
+    std::cout << shape.m << "x" << shape.n << "x" << shape.k << ": " << time.count() / 1e6 << " ms";
+    if (time.count()) std::cout << " (" << flop / time.count() << " GFLOP/s)";
+    std::cout << "\n";
   }
-};
 
-} // namespace app
+  const auto best = timings.front().shape;
+  std::cout << "Best tile shape: --lsz=" << best.m << "x" << best.n << "x" << best.k << "\n";
+  return EXIT_SUCCESS;
+}
 
-namespace {
+// Largest absolute difference from the full precision tiledarb product, relative to its largest absolute element
+void print_error(const matrix_type &res, const matrix_type &classic) {
+  double max_diff = 0, max_value = 0;
+  for (auto it = res.begin(), classic_it = classic.begin(); it != res.end(); ++it, ++classic_it) {
+    max_diff = std::max(max_diff, std::abs(static_cast<double>(*it) - static_cast<double>(*classic_it)));
+    max_value = std::max(max_value, std::abs(static_cast<double>(*classic_it)));
+  }
 
-#ifdef EIGEN_MAT_MULT
-eigen_matrix_type to_eigen_matrix(const matrix_type &matrix) {
-  eigen_matrix_type e = Eigen::Map<const eigen_matrix_type>(matrix.data(), matrix.rows(), matrix.cols());
-  return e;
+  std::cout << "Max abs error vs tiledarb: " << max_diff;
+  if (max_value != 0) std::cout << " (relative " << max_diff / max_value << ")";
+  std::cout << "\n";
 }
-#endif
 
 } // namespace
 
@@ -220,7 +342,7 @@ int main(int argc, char *argv[]) try {
   auto help_option = op.add<popl::Switch>("h", "help", "Print this help message");
   auto print_option = op.add<popl::Switch>("p", "print", "Print on failure");
   auto eigen_option = op.add<popl::Switch>("e", "eigen", "Compare with Eigen matrix multiplication");
-  auto skip_option = op.add<popl::Switch>("s", "skip", "Skip naive cpu calculation");
+  auto skip_option = op.add<popl::Switch>("s", "skip", "Skip cpu calculation");
 
   auto lower_option = op.add<popl::Implicit<TYPE__>>("", "lower", "Lower bound", -32);
   auto upper_option = op.add<popl::Implicit<TYPE__>>("", "upper", "Upper bound", +32);
@@ -229,9 +351,44 @@ int main(int argc, char *argv[]) try {
   auto ay_option = op.add<popl::Implicit<unsigned>>("", "ay", "Number of cols in matrix A", 512);
   auto by_option = op.add<popl::Implicit<unsigned>>("", "by", "Number of cols in matrix B", 512);
 
-  auto kernel_option =
-      op.add<popl::Implicit<std::string>>("", "kernel", "Which kernel to use: naive, tiled, tiledarb", "naive");
-  auto lsz_option = op.add<popl::Implicit<unsigned>>("", "lsz", "Local tile size", 256);
+  auto kernel_option = op.add<popl::Implicit<std::string>>(
+      "", "kernel",
+      "Which kernel to use: naive, tiled, tiledarb, regblocked, ooc, strassen, half, bf16, int8, csr, syrk, trmm, cpu",
+      "naive");
+  auto lsz_option = op.add<popl::Implicit<std::string>>(
+      "", "lsz", "Local tile size, or MxNxK tile shape of tiled and tiledarb (e.g. 32x8x16)", "256");
+  auto sweep_option =
+      op.add<popl::Switch>("", "sweep", "Time tiled or tiledarb with every tile shape that fits the device");
+  auto prefetch_option =
+      op.add<popl::Switch>("", "prefetch", "Double buffer tiles and prefetch the next ones in tiled kernels");
+  auto tile_k_option = op.add<popl::Implicit<unsigned>>("", "tilek", "Depth of tiles in the regblocked kernel", 16);
+  auto wpt_option =
+      op.add<popl::Implicit<unsigned>>("", "wpt", "Size of the micro-tile of a work-item in regblocked: 4 or 8", 4);
+  auto batch_option =
+      op.add<popl::Implicit<unsigned>>("", "batch", "Benchmark a batch of products in one launch vs a loop", 10000);
+  auto chain_option = op.add<popl::Implicit<std::string>>(
+      "", "chain", "Multiply a chain of matrices d0 x d1, d1 x d2, ... in the optimal order", "400,200,300,100,300");
+  auto power_option =
+      op.add<popl::Implicit<unsigned>>("", "power", "Raise a square --ax x --ax matrix A to this power", 8);
+  auto block_option = op.add<popl::Implicit<unsigned>>(
+      "", "block", "Size of panels streamed through the device by ooc, 0 to fit into device memory", 0);
+  auto cutoff_option = op.add<popl::Implicit<unsigned>>(
+      "", "cutoff", "Size below which strassen switches to the classic kernel, 0 to tune on the device", 0);
+  auto density_option = op.add<popl::Implicit<double>>("", "density", "Fraction of nonzero elements in matrix A", 1.0);
+  auto verify_option = op.add<popl::Implicit<std::string>>(
+      "", "verify", "How to check the result: full, freivalds, auto (freivalds past 2^30 multiply-adds)", "auto");
+  auto rounds_option =
+      op.add<popl::Implicit<unsigned>>("", "rounds", "Number of random vectors in the Freivalds check", 8);
+  auto bias_option = op.add<popl::Switch>("", "bias", "Add a random bias to every column of C in the epilogue");
+  auto activation_option = op.add<popl::Implicit<std::string>>(
+      "", "activation", "Activation applied in the epilogue: none, relu, clamp (to --lower and --upper)", "none");
+  auto uplo_option = op.add<popl::Implicit<std::string>>(
+      "", "uplo", "Triangle of C computed by syrk or nonzero triangle of A in trmm: lower, upper", "lower");
+  auto mirror_option = op.add<popl::Switch>("", "mirror", "Mirror the triangle computed by syrk into the other one");
+  auto trans_a_option =
+      op.add<popl::Switch>("", "transa", "Pass A stored transposed (column-major) and let the engine handle it");
+  auto trans_b_option =
+      op.add<popl::Switch>("", "transb", "Pass B stored transposed (column-major) and let the engine handle it");
 
   op.parse(argc, argv);
 
@@ -241,8 +398,9 @@ int main(int argc, char *argv[]) try {
   }
 
   const auto lower = lower_option->value(), upper = upper_option->value();
-  const auto kernel_name = kernel_option->value();
-  const auto lsz = lsz_option->value();
+  const auto shape = parse_tile_shape(lsz_option->value());
+  // Kernels other than tiled and tiledarb take square tiles
+  const auto lsz = shape.m;
   const auto ax = ax_option->value(), ay = ay_option->value(), by = by_option->value();
 
   if (lower >= upper) {
@@ -254,37 +412,275 @@ int main(int argc, char *argv[]) try {
   const bool print_on_failure = print_option->is_set();
   const bool compare_eigen = eigen_option->is_set();
 
+  // Past this many multiply-adds the CPU reference takes longer than the whole GPU job, so results are checked with
+  // Freivalds' algorithm in O(n^2) unless asked otherwise
+  constexpr double c_freivalds_threshold = 1ull << 30;
+  const auto verify = verify_option->value();
+  if (verify != "full" && verify != "freivalds" && verify != "auto") {
+    std::cout << "Unknown verification mode: " << verify << "\n";
+    return EXIT_FAILURE;
+  }
+
+  const std::map<std::string, matmult::activation> activations = {
+      {"none", matmult::activation::none}, {"relu", matmult::activation::relu}, {"clamp", matmult::activation::clamp}};
+  if (!activations.contains(activation_option->value())) {
+    std::cout << "Unknown activation: " << activation_option->value() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  const std::map<std::string, matmult::triangle> triangles = {{"lower", matmult::triangle::lower},
+                                                              {"upper", matmult::triangle::upper}};
+  if (!triangles.contains(uplo_option->value())) {
+    std::cout << "Unknown triangle: " << uplo_option->value() << "\n";
+    return EXIT_FAILURE;
+  }
+  const auto uplo = triangles.at(uplo_option->value());
+
+  // Syrk computes C = A * A^T, trmm multiplies by a triangular A
+  const bool syrk = (kernel_option->value() == "syrk"), trmm = (kernel_option->value() == "trmm");
+  if (syrk && by != ax) {
+    std::cout << "Error: syrk multiplies A by its transpose, --by should be equal to --ax\n";
+    return EXIT_FAILURE;
+  }
+  if (trmm && ay != ax) {
+    std::cout << "Error: triangular matrix A should be square, --ay should be equal to --ax\n";
+    return EXIT_FAILURE;
+  }
+  // Without mirroring the other triangle of the syrk result is zero
+  const bool half_result = (syrk && !mirror_option->is_set());
+
+  // Syrk stores C symmetric, which a bias of every column would break, so its kernel takes no bias
+  if (syrk && bias_option->is_set()) {
+    std::cout << "Warning: syrk doesn't add a bias to its symmetric result, ignoring --bias option\n";
+  }
+
+  // Bias and activation are fused into the store of C by the kernels that support epilogues
+  const matmult::epilogue<TYPE__> epilogue = {.bias = bias_option->is_set() && !syrk,
+                                              .act = activations.at(activation_option->value()),
+                                              .lower = lower,
+                                              .upper = upper,
+                                              .convert = {}};
+
+  // Freivalds' check only applies to the full product itself
+  const bool freivalds = epilogue.empty() && !half_result &&
+                         (verify == "freivalds" || (verify == "auto" && 1.0 * ax * ay * by > c_freivalds_threshold));
+  if (!epilogue.empty() && verify == "freivalds") {
+    std::cout << "Warning: Freivalds' check doesn't apply to epilogues, comparing with the full product instead\n";
+  }
+  if (half_result && verify == "freivalds") {
+    std::cout << "Warning: Freivalds' check doesn't apply to a triangle of the product, comparing with the reference "
+                 "instead\n";
+  }
+  if (!freivalds && rounds_option->is_set()) {
+    std::cout << "Warning: result isn't checked with Freivalds' algorithm, ignoring --rounds option\n";
+  }
+
 #ifndef EIGEN_MAT_MULT
   if (compare_eigen) std::cout << "Warning: app wasn't built with Eigen, ignoring --eigen option\n";
 #endif
 
-  std::unique_ptr<app::i_matmult> mult;
-  if (kernel_name == "naive") {
-    mult = std::make_unique<app::naive_matmult>();
+  if (batch_option->is_set()) {
+    if (kernel_option->is_set()) std::cout << "Warning: batches are always multiplied by tiledarb kernel\n";
+    // Default local size is too large for small matrices, use 16 x 16 tiles unless asked otherwise
+    const auto tile = (lsz_option->is_set() ? shape : matmult::tile_shape::square(16));
+    return run_batched(batch_option->value(), ax, ay, by, tile, prefetch_option->is_set(), lower, upper, skip_cpu);
+  }
+
+  if (chain_option->is_set() && power_option->is_set()) {
+    std::cout << "Error: --chain and --power can't be combined\n";
+    return EXIT_FAILURE;
+  }
+
+  if (chain_option->is_set() || power_option->is_set()) {
+    if (kernel_option->is_set()) std::cout << "Warning: chains and powers are always multiplied by tiledarb kernel\n";
+    // Default local size is too large for small matrices, use 16 x 16 tiles unless asked otherwise
+    const auto tile = (lsz_option->is_set() ? lsz : 16);
+    if (power_option->is_set()) return run_power(power_option->value(), ax, tile, lower, upper, skip_cpu);
+
+    const auto dims = parse_chain(chain_option->value());
+    if (dims.size() < 3) {
+      std::cout << "Error: chain should have at least two matrices\n";
+      return EXIT_FAILURE;
+    }
+    return run_chain(dims, tile, lower, upper, skip_cpu);
+  }
+
+  auto kernel_name = kernel_option->value();
+  if (kernel_name != "cpu" && !matmult::gpu_matmult<TYPE__>::available()) {
+    std::cout << "Warning: no suitable OpenCL device found, falling back to \"cpu\" kernel\n";
+    kernel_name = "cpu";
+  }
+
+  matrix_type bias{1, by};
+  if (epilogue.bias) clutils::create_random_number_generator<TYPE__>(lower, upper)(bias);
+
+  // Base of the engines that support epilogues, the bias is uploaded into its context
+  const auto epilogue_base = [&epilogue, &bias]() {
+    matmult::gpu_matmult<TYPE__> base;
+    if (epilogue.empty()) return base;
+    return base.with_epilogue(epilogue, base.upload(bias).buffer());
+  };
+
+  if (sweep_option->is_set()) {
+    if (kernel_name != "tiled" && kernel_name != "tiledarb") {
+      std::cout << "Error: only tiled and tiledarb kernels have tile shapes to sweep\n";
+      return EXIT_FAILURE;
+    }
+    return run_sweep(kernel_name == "tiled", ax, ay, by, prefetch_option->is_set());
+  }
+
+  std::unique_ptr<matmult::i_matmult<TYPE__>> mult;
+  out_of_core_matmult *streamed = nullptr;
+  // Full precision product to compare with for engines that reorder or round computations
+  std::unique_ptr<tiled_arbitrary_matmult> classic;
+  bool inexact = false;
+
+  const std::map<std::string, matmult::storage_format> storage_formats = {
+      {"half", matmult::storage_format::half},
+      {"bf16", matmult::storage_format::bfloat16},
+      {"int8", matmult::storage_format::int8}};
+
+  if (kernel_name == "cpu") {
+    mult = std::make_unique<cpu_matmult>();
+  } else if (kernel_name == "naive") {
+    mult = std::make_unique<naive_matmult>(epilogue_base());
   } else if (kernel_name == "tiled") {
-    mult = std::make_unique<app::tiled_matmult>(lsz);
+    mult = std::make_unique<tiled_matmult>(shape, epilogue_base(), prefetch_option->is_set());
   } else if (kernel_name == "tiledarb") {
-    mult = std::make_unique<app::tiled_arbitrary_matmult>(lsz);
+    mult = std::make_unique<tiled_arbitrary_matmult>(shape, epilogue_base(), prefetch_option->is_set());
+  } else if (kernel_name == "regblocked") {
+    // Default local size is too large for a register-blocked tile, use 64 x 64 unless asked otherwise
+    const auto tile = (lsz_option->is_set() ? lsz : 64);
+    mult = std::make_unique<regblocked_matmult>(tile, tile_k_option->value(), wpt_option->value(), epilogue_base());
+  } else if (kernel_name == "ooc") {
+    // Panels are multiplied by the tiledarb kernel, use 16 x 16 tiles unless asked otherwise
+    const auto tile = (lsz_option->is_set() ? lsz : 16);
+    auto ooc = std::make_unique<out_of_core_matmult>(tile, block_option->value(), prefetch_option->is_set());
+    streamed = ooc.get();
+    mult = std::move(ooc);
+  } else if (kernel_name == "strassen") {
+    // Leaves are multiplied by the tiledarb kernel, use 16 x 16 tiles unless asked otherwise
+    const auto tile = (lsz_option->is_set() ? lsz : 16);
+    matmult::gpu_matmult<TYPE__> base;
+    auto strassen = std::make_unique<strassen_matmult>(tile, cutoff_option->value(), base, prefetch_option->is_set());
+    if (!cutoff_option->value()) strassen->tune_cutoff();
+    std::cout << "Strassen cutoff: " << strassen->cutoff() << "\n";
+    classic = std::make_unique<tiled_arbitrary_matmult>(tile, base, prefetch_option->is_set());
+    mult = std::move(strassen);
+    // Strassen-Winograd sums differ in rounding from the classic product, so only integral TYPE__ is checked exactly
+    inexact = std::is_floating_point_v<TYPE__>;
+  } else if (storage_formats.contains(kernel_name)) {
+    // A and B are stored in reduced precision, use 16 x 16 tiles unless asked otherwise
+    const auto tile = (lsz_option->is_set() ? lsz : 16);
+    matmult::gpu_matmult<TYPE__> base;
+    mult = std::make_unique<mixed_matmult>(storage_formats.at(kernel_name), tile, base);
+    classic = std::make_unique<tiled_arbitrary_matmult>(tile, base);
+    // Int8 storage is exact only for integral TYPE__, floating point inputs are rounded to integers on upload
+    inexact = (kernel_name != "int8" || std::is_floating_point_v<TYPE__>);
+  } else if (kernel_name == "csr") {
+    matmult::gpu_matmult<TYPE__> base;
+    mult = std::make_unique<sparse_matmult>(base);
+    // Dense product to find the density at which CSR starts to pay off, use 16 x 16 tiles unless asked otherwise
+    classic = std::make_unique<tiled_arbitrary_matmult>((lsz_option->is_set() ? lsz : 16), base);
+  } else if (kernel_name == "syrk" || kernel_name == "trmm") {
+    // Half of the tiles are skipped compared to tiledarb, use 16 x 16 tiles unless asked otherwise
+    const auto tile = (lsz_option->is_set() ? lsz : 16);
+    auto base = epilogue_base();
+    if (syrk) mult = std::make_unique<symmetric_matmult>(uplo, tile, base, mirror_option->is_set());
+    else mult = std::make_unique<triangular_matmult>(uplo, tile, base);
+    classic = std::make_unique<tiled_arbitrary_matmult>(tile, base);
   } else {
     std::cout << "Unknown type of kernel: " << kernel_name << "\n";
     return EXIT_FAILURE;
   }
 
-  if (kernel_name == "naive" && lsz_option->is_set()) {
-    std::cout << "Warning: local size provided but kernel used is \"naive\", ignoring --lsz option\n";
+  if (kernel_name != "tiled" && kernel_name != "tiledarb" && !shape.is_square()) {
+    std::cout << "Warning: kernel used only takes square tiles, using --lsz=" << lsz << "\n";
+  }
+
+  if ((kernel_name == "naive" || kernel_name == "cpu") && lsz_option->is_set()) {
+    std::cout << "Warning: local size provided but kernel used is \"" << kernel_name << "\", ignoring --lsz option\n";
+  }
+
+  if (kernel_name != "tiled" && kernel_name != "tiledarb" && kernel_name != "ooc" && kernel_name != "strassen" &&
+      prefetch_option->is_set()) {
+    std::cout << "Warning: kernel used is not tiled or built on it, ignoring --prefetch option\n";
+  }
+
+  if (kernel_name != "strassen" && cutoff_option->is_set()) {
+    std::cout << "Warning: kernel used is not \"strassen\", ignoring --cutoff option\n";
   }
 
+  if (kernel_name != "ooc" && block_option->is_set()) {
+    std::cout << "Warning: kernel used is not \"ooc\", ignoring --block option\n";
+  }
+
+  const bool fused_epilogue = (kernel_name == "naive" || kernel_name == "tiled" || kernel_name == "tiledarb" ||
+                               kernel_name == "regblocked" || kernel_name == "syrk" || kernel_name == "trmm");
+  if (!fused_epilogue && !epilogue.empty()) {
+    std::cout << "Warning: kernel used doesn't support epilogues, ignoring --bias and --activation options\n";
+  }
+
+  if (kernel_name != "regblocked" && (tile_k_option->is_set() || wpt_option->is_set())) {
+    std::cout << "Warning: kernel used is not \"regblocked\", ignoring --tilek and --wpt options\n";
+  }
+
+  if (kernel_name != "syrk" && kernel_name != "trmm" && uplo_option->is_set()) {
+    std::cout << "Warning: kernel used is not \"syrk\" or \"trmm\", ignoring --uplo option\n";
+  }
+
+  if (kernel_name != "syrk" && mirror_option->is_set()) {
+    std::cout << "Warning: kernel used is not \"syrk\", ignoring --mirror option\n";
+  }
+
+  // Tiled kernels read transposed operands in place, the other dense engines transpose them on the device first
+  const bool transposable = (kernel_name == "naive" || kernel_name == "tiled" || kernel_name == "tiledarb" ||
+                             kernel_name == "regblocked" || kernel_name == "strassen");
+  if (!transposable && (trans_a_option->is_set() || trans_b_option->is_set())) {
+    std::cout << "Warning: kernel used doesn't take transposed operands, ignoring --transa and --transb options\n";
+  }
+  const bool trans_a = transposable && trans_a_option->is_set(), trans_b = transposable && trans_b_option->is_set();
+
   const auto print_sep = []() { std::cout << " -------- \n"; };
   std::cout << "Multiplying A [" << ax << " x " << ay << "] by B [" << ay << " x " << by << "]\n";
   print_sep();
 
   matrix_type a{ax, ay}, b{ay, by};
 
+  const auto density = density_option->value();
   auto random_filler = clutils::create_random_number_generator<matrix_type::value_type>(lower, upper);
-  random_filler(a);
+  auto sparse_filler = clutils::create_random_number_generator<matrix_type::value_type>(lower, upper, density);
+  sparse_filler(a);
   random_filler(b);
 
-  std::chrono::milliseconds wall_cpu_naive;
+  const auto in_triangle = [uplo](std::size_t i, std::size_t j) {
+    return (uplo == matmult::triangle::lower ? j <= i : j >= i);
+  };
+
+  // The kernel mustn't read the other triangle of a triangular A, so it's filled with garbage that would show up in C.
+  // References multiply by a copy with that triangle zeroed instead.
+  matrix_type a_triangular;
+  if (syrk) {
+    b = transposed(a);
+  } else if (trmm) {
+    a_triangular = a;
+    for (std::size_t i = 0; i < ax; ++i) {
+      for (std::size_t j = 0; j < ay; ++j) {
+        if (in_triangle(i, j)) continue;
+        a.data()[i * ay + j] = 42;
+        a_triangular.data()[i * ay + j] = 0;
+      }
+    }
+  }
+  const matrix_type &a_ref = (trmm ? a_triangular : a);
+
+  if (kernel_name == "csr") {
+    const auto nnz = std::count_if(a.begin(), a.end(), [](auto v) { return v != 0; });
+    std::cout << "Matrix A has " << nnz << " nonzeros, density " << static_cast<double>(nnz) / a.rows() / a.cols()
+              << "\n";
+  }
+
+  std::chrono::milliseconds wall_cpu;
 
   const auto measure_cpu_time = [](auto func) {
     auto wall_start = std::chrono::high_resolution_clock::now();
@@ -293,15 +689,37 @@ int main(int argc, char *argv[]) try {
     return std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start);
   };
 
+  // Reference is computed by the blocked CPU engine, unless that's the one being measured
+  const bool cpu_engine = (kernel_name == "cpu");
+  const bool full_reference = (!skip_cpu && !freivalds);
   matrix_type c;
-  if (!skip_cpu) {
-    wall_cpu_naive = measure_cpu_time([&a, &b, &c]() { c = a * b; });
+  if (full_reference && cpu_engine) {
+    wall_cpu = measure_cpu_time([&a_ref, &b, &c]() { c = a_ref * b; });
+  } else if (full_reference) {
+    wall_cpu = measure_cpu_time([&a_ref, &b, &c]() { c = cpu_matmult{}.multiply(a_ref, b); });
+  }
+
+  if (full_reference && fused_epilogue && !epilogue.empty()) {
+    for (std::size_t i = 0; i < c.rows(); ++i) {
+      for (std::size_t j = 0; j < c.cols(); ++j) {
+        auto &value = c.data()[i * c.cols() + j];
+        value = epilogue.apply(value, bias.data()[j]);
+      }
+    }
+  }
+
+  if (full_reference && half_result) {
+    for (std::size_t i = 0; i < c.rows(); ++i) {
+      for (std::size_t j = 0; j < c.cols(); ++j) {
+        if (!in_triangle(i, j)) c.data()[i * c.cols() + j] = 0;
+      }
+    }
   }
 
 #ifdef EIGEN_MAT_MULT
   std::chrono::milliseconds wall_cpu_eigen;
   if (compare_eigen) {
-    eigen_matrix_type a_e = to_eigen_matrix(a), b_e = to_eigen_matrix(b), c_e;
+    eigen_matrix_type a_e = to_eigen_matrix(a_ref), b_e = to_eigen_matrix(b), c_e;
     wall_cpu_eigen = measure_cpu_time([&a_e, &b_e, &c_e]() { c_e = a_e * b_e; });
   }
 #endif
@@ -316,39 +734,102 @@ int main(int argc, char *argv[]) try {
     }
   };
 
-  app::profiling_info prof_info;
+  clutils::profiling_info prof_info;
+
+  // Each element of C takes ay multiplications and additions
+  const double flop = 2.0 * ax * ay * by;
+  const auto print_time = [flop](auto name, std::chrono::milliseconds time) {
+    std::cout << name << " time: " << time.count() << " ms";
+    if (time.count()) std::cout << " (" << flop / time.count() / 1e6 << " GFLOP/s)";
+    std::cout << "\n";
+  };
+
+  matmult::streaming_info stream_info;
+  const auto run_product = [&]() {
+    if (streamed) return streamed->multiply_streamed(a, b, &prof_info, &stream_info);
+    // B is A^T only for the reference, syrk reads A twice instead
+    if (kernel_name == "syrk") return dynamic_cast<symmetric_matmult &>(*mult).rank_k(a, &prof_info);
+    if (!trans_a && !trans_b) return mult->multiply(a, b, &prof_info);
+
+    // Operands are stored transposed before the timer starts
+    auto &gpu = dynamic_cast<matmult::gpu_matmult<TYPE__> &>(*mult);
+    return gpu.multiply_transposed((trans_a ? transposed(a) : a), trans_a, (trans_b ? transposed(b) : b), trans_b,
+                                   &prof_info);
+  };
 
-  auto res = mult->multiply(a, b, &prof_info);
-  if (!skip_cpu) std::cout << "CPU wall time: " << wall_cpu_naive.count() << " ms\n";
+  auto res = run_product();
+  if (full_reference) print_time((cpu_engine ? "CPU naive wall" : "CPU wall"), wall_cpu);
 
 #ifdef EIGEN_MAT_MULT
-  if (compare_eigen) std::cout << "Eigen wall time: " << wall_cpu_eigen.count() << " ms\n";
+  if (compare_eigen) print_time("Eigen wall", wall_cpu_eigen);
 #endif
 
-  std::cout << "GPU wall time: " << prof_info.wall.count() << " ms\n";
-  std::cout << "GPU pure time: " << prof_info.pure.count() << " ms\n";
+  const std::string engine_label = (cpu_engine ? "CPU blocked" : "GPU");
+  print_time(engine_label + " wall", prof_info.wall);
+  if (!cpu_engine) print_time("GPU pure", prof_info.pure);
+
+  if (streamed) {
+    std::cout << "Panels of " << streamed->block() << " x " << streamed->block() << " elements\n";
+    std::cout << "Transfer busy time: " << stream_info.transfer.count() << " ms\n";
+    std::cout << "Compute busy time: " << stream_info.compute.count() << " ms\n";
+    std::cout << "Transfer/compute overlap: " << stream_info.overlap.count() << " ms";
+    if (stream_info.transfer.count()) {
+      const auto hidden = 100.0 * stream_info.overlap.count() / stream_info.transfer.count();
+      std::cout << " (" << hidden << "% of transfers hidden)";
+    }
+    std::cout << "\n";
+  }
+
+  if (classic) {
+    clutils::profiling_info classic_info;
+    const auto classic_res = classic->multiply(a_ref, b, &classic_info);
+    print_time("Tiledarb pure", classic_info.pure);
+    if (prof_info.pure.count()) {
+      std::cout << "Speedup over tiledarb: " << static_cast<double>(classic_info.pure.count()) / prof_info.pure.count()
+                << "\n";
+    }
+    // Tiledarb computes both triangles of a symmetric product
+    if (!half_result) print_error(res, classic_res);
+  }
 
   print_sep();
 
-  const auto validate_results = [&c, &res, &a, &b, print_on_failure]() {
-    if (c == res) {
-      std::cout << "GPU matrix multiplication works fine\n";
+  const auto validate_results = [&]() {
+    bool passed = false;
+    if (freivalds) {
+      clutils::freivalds_result check;
+      const auto wall_check = measure_cpu_time([&]() {
+        check = clutils::freivalds_check<TYPE__>({a_ref.data(), a_ref.rows() * a_ref.cols()},
+                                                 {b.data(), b.rows() * b.cols()}, {res.data(), res.rows() * res.cols()},
+                                                 ax, ay, by, rounds_option->value());
+      });
+      std::cout << "Freivalds check with " << rounds_option->value() << " rounds: " << wall_check.count() << " ms";
+      if constexpr (std::is_floating_point_v<TYPE__>) std::cout << ", max relative residual " << check.max_error;
+      std::cout << "\n";
+      passed = check.passed;
+    } else {
+      passed = (c == res);
+    }
+
+    if (passed) {
+      std::cout << engine_label << " matrix multiplication works fine\n";
       return EXIT_SUCCESS;
     }
 
-    std::cout << "GPU matrix multiplication is borked\n";
+    std::cout << engine_label << " matrix multiplication is borked\n";
     if (!print_on_failure) return EXIT_FAILURE;
 
-    matrix_print("Matrix A", a);
+    matrix_print("Matrix A", a_ref);
     matrix_print("Matrix B", b);
 
-    matrix_print("Matrix from GPU", res);
-    matrix_print("Correct", c);
+    matrix_print("Matrix from " + engine_label, res);
+    if (!freivalds) matrix_print("Correct", c);
 
     return EXIT_FAILURE;
   };
 
-  if (skip_cpu) return EXIT_SUCCESS;
+  // Rounded storage and reordered sums can't match the reference exactly, their error is reported above instead
+  if (skip_cpu || inexact) return EXIT_SUCCESS;
   return validate_results();
 } catch (cl::BuildError &e) {
   std::cerr << "Compilation failed:\n";
@@ -45,7 +45,8 @@ def main():
     entry = pragmap["kernel"]["entry"]
     output_path = Path(args.output if args.output is not None else "./")
     macros = {} if "macros" not in pragmap else pragmap["macros"]
-    functor_args = ", ".join(pragmap["signature"])
+    signature = pragmap["signature"]
+    functor_args = ", ".join(signature)
 
     if output_path.is_dir():
         output_file = Path(str(output_path) +
@@ -58,8 +59,15 @@ def main():
 
     header_text = "#include <CL/opencl.hpp>\n#include <string>\n#include <utils.hpp>\n\n"
     header_text += "struct {} {{ \n".format(kernel_class_name)
-    header_text += "\tusing functor_type = cl::KernelFunctor<{}>;\n\n".format(
-        functor_args)
+    if "INDEX_TYPE" in signature:
+        # Arguments typed as INDEX_TYPE take cl_uint or cl_ulong, depending on the index type the source is built with
+        index_args = ", ".join("t_index" if i == "INDEX_TYPE" else i for i in signature)
+        header_text += "\ttemplate <typename t_index> using indexed_functor_type = cl::KernelFunctor<{}>;\n".format(
+            index_args)
+        header_text += "\tusing functor_type = indexed_functor_type<cl_ulong>;\n\n"
+    else:
+        header_text += "\tusing functor_type = cl::KernelFunctor<{}>;\n\n".format(
+            functor_args)
     source_args = ["{} {}_param".format(i["type"], i["name"]) for i in macros]
 
     header_text += "\tstatic std::string source({}) {{\n\t\tstatic const std::string {}_source = R\"(\n{})\";\n\n".format(", ".join(source_args), kernel_class_name,